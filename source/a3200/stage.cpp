@@ -1,4 +1,5 @@
 #include "stage.h"
+#include <cmath>
 
 namespace stim {
 	A3200::A3200() {	// default constructor -- set axis translation velocities
@@ -72,6 +73,22 @@ namespace stim {
 		return 0;
 	}
 
+	int A3200::moveto(DOUBLE *origin, DOUBLE z) {	// overload function MOVETO: translate stage to a position in the xy-plane and the z-drive together
+		DOUBLE from[3];
+		for (int k = 0; k < 3; k++)
+			if (read_position(k, from[k])) return 1;
+		DOUBLE to[3] = { origin[0], origin[1], z };
+		double dxy = std::hypot(to[0] - from[0], to[1] - from[1]), dz = std::fabs(to[2] - from[2]);
+		double speed = std::fminf(x_speed, y_speed);
+		if (dz > 0.0)	// the vector speed is shared by all three axes, keep the z-drive at its own speed
+			speed = std::fmin(speed, z_speed * std::sqrt(dxy * dxy + dz * dz) / dz);
+		if (!A3200MotionSetupAbsolute(handle, TASKID_01)) { perror(); return 1; }	// switch to ABSOLUTE mode
+		if (!A3200MotionLinearVelocity(handle, TASKID_01, (AXISMASK)(AXISMASK_00 | AXISMASK_01 | AXISMASK_02), to, (DOUBLE)speed)) { perror(); return 1; }	// translate all three axes along one line
+		if (!A3200MotionWaitForMotionDone(handle, (AXISMASK)(AXISMASK_00 | AXISMASK_01 | AXISMASK_02), WAITOPTION_MoveDone, -1, NULL)) { perror(); return 1; }	// wait until motion done
+
+		return 0;
+	}
+
 	int A3200::moveto(AXISMASK midx, DOUBLE position) {	// overload function MOVETO: translate stage to a preset position along one axis
 		if (!A3200MotionSetupAbsolute(handle, TASKID_01)) { perror(); return 1; }	// switch to ABSOLUTE mode
 		float speed;
@@ -112,9 +129,30 @@ namespace stim {
 		return 0;
 	}
 
+	int A3200::start_moveby(AXISINDEX idx, DOUBLE distance, DOUBLE speed) {	// non-blocking, positions can be polled while the axis moves
+		if (!A3200MotionSetupIncremental(handle, TASKID_01)) { perror(); return 1; }// switch to INCREMENTAL mode
+		if (!A3200MotionMoveInc(handle, TASKID_01, idx, distance, speed)) { perror(); return 1; }
+
+		return 0;
+	}
+
+	int A3200::wait(AXISMASK midx) {
+		if (!A3200MotionWaitForMotionDone(handle, midx, WAITOPTION_MoveDone, -1, NULL)) { perror(); return 1; }	// wait until motion done
+
+		return 0;
+	}
+
+	int A3200::done(AXISMASK midx, bool &finished) {	// a zero timeout only reports the motion state
+		BOOL timed_out = 0;
+		if (!A3200MotionWaitForMotionDone(handle, midx, WAITOPTION_MoveDone, 0, &timed_out)) { perror(); return 1; }
+		finished = !timed_out;
+
+		return 0;
+	}
+
 	int A3200::read_position(int idx, DOUBLE &position) {
 		if (!A3200StatusGetItem(handle, idx, STATUSITEM_PositionFeedback, 0, &position)) { perror(); return 1; }
 
 		return 0;
 	}
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -28,8 +28,12 @@ namespace stim {
 		void set_speed(AXISINDEX idx, float value);		// set axis translation velcities
 		int home(AXISMASK midx);	// home process
 		int moveto(DOUBLE *origin);	// translate to position in the xy-plane
+		int moveto(DOUBLE *origin, DOUBLE z);	// translate to position in the xy-plane and the z-drive to z in one coordinated move
 		int moveto(AXISMASK midx, DOUBLE position);		// translate an axis to position
 		int moveby(AXISINDEX idx, DOUBLE distance);		// translate an axis by distance
+		int start_moveby(AXISINDEX idx, DOUBLE distance, DOUBLE speed);	// start translating an axis by distance at speed in mm/s and return while it moves
+		int wait(AXISMASK midx);	// wait until the motion of an axis is done
+		int done(AXISMASK midx, bool &finished);	// check without waiting whether the motion of an axis is done
 		int read_position(int idx, DOUBLE &position);	// read current position along one axis
 	};
 }
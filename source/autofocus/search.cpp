@@ -0,0 +1,210 @@
+#include "search.h"
+#include <iostream>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+
+namespace af {
+	static const double same = 1.0e-6;	// positions closer than this in um are the same sample
+	static const char *names[] = { "HILL", "COARSE", "GOLDEN" };
+
+	search::search() {
+		z = 0.0; fm = 0.0f;
+		limit = false; edge = 0;
+		peak = 0.0; residual = 0.0f;
+		fitted = false;
+	}
+
+	int search::probe(double p, float &v) {
+		p = std::min(w.hi, std::max(w.lo, p));
+		for (size_t k = 0; k < samples.size(); k++)
+			if (std::fabs(samples[k].z - p) < same) { v = samples[k].fm; return 0; }
+		if (measure(p, v)) return 1;
+		sample s = { p, v };
+		samples.push_back(s);
+		if (samples.size() == 1 || v > fm) { z = p; fm = v; }	// ties keep the earlier, closer to the origin for the climbs
+		return 0;
+	}
+
+	int search::walk(int direction) {
+		int n = (int)std::floor((direction < 0 ? -w.lo : w.hi) / w.step + same);	// steps that fit in the arm
+		float previous = 0.0f;
+		int peak = 0;
+		for (int k = 0; k <= n; k++) {
+			float v;
+			if (probe(direction * k * w.step, v)) return -1;
+			if (k > 0 && v < previous) break;	// the measure dropped, the last step was the peak of this arm
+			previous = v; peak = k;
+		}
+		return peak;
+	}
+
+	int search::hill() {
+		int peak = walk(-1);	// negative arm first to avoid potential collision
+		if (peak < 0) return 1;
+		if (peak == 0 && walk(1) < 0) return 1;	// the origin is the peak of the negative arm, the optimum may be on the positive one
+		return 0;
+	}
+
+	int search::climb(double s) {
+		double start = z;
+		float v;
+		if (start - s >= w.lo - same && probe(start - s, v)) return 1;
+		if (start + s <= w.hi + same && probe(start + s, v)) return 1;
+		if (z == start) return 0;	// still the peak at this step
+		double direction = z < start ? -s : s;
+		for (;;) {
+			double at = z, next = z + direction;
+			if (next < w.lo - same || next > w.hi + same) break;
+			if (probe(next, v)) return 1;
+			if (z == at) break;	// the measure dropped
+		}
+		return 0;
+	}
+
+	int search::coarse() {
+		float v;
+		if (probe(0.0, v)) return 1;
+		for (double s = w.step;; s = std::max(s / 2.0, w.tolerance)) {
+			if (climb(s)) return 1;
+			if (s <= w.tolerance) break;
+		}
+		return 0;
+	}
+
+	int search::golden() {	// assumes a single peak in the window
+		const double g = 0.6180339887498949;
+		double a = w.lo, b = w.hi;
+		double c = b - g * (b - a), d = a + g * (b - a);
+		float fc, fd;
+		if (probe(c, fc) || probe(d, fd)) return 1;
+		while (b - a > w.tolerance) {
+			if (fc >= fd) {	// the peak is in [a, d]
+				b = d; d = c; fd = fc;
+				c = b - g * (b - a);
+				if (probe(c, fc)) return 1;
+			}
+			else {			// the peak is in [c, b]
+				a = c; c = d; fc = fd;
+				d = a + g * (b - a);
+				if (probe(d, fd)) return 1;
+			}
+		}
+		return 0;
+	}
+
+	// least-squares parabola y = c[0] + c[1] x + c[2] x^2 through n >= 3 points, 1 when the points do not determine one
+	static int parabola(const double *x, const double *y, int n, double *c) {
+		double a[3][4] = {};	// normal equations, augmented
+		for (int i = 0; i < n; i++) {
+			double p[3] = { 1.0, x[i], x[i] * x[i] };
+			for (int r = 0; r < 3; r++) {
+				for (int k = 0; k < 3; k++)
+					a[r][k] += p[r] * p[k];
+				a[r][3] += p[r] * y[i];
+			}
+		}
+		for (int k = 0; k < 3; k++) {	// Gaussian elimination with partial pivoting
+			int pivot = k;
+			for (int r = k + 1; r < 3; r++)
+				if (std::fabs(a[r][k]) > std::fabs(a[pivot][k])) pivot = r;
+			if (std::fabs(a[pivot][k]) < 1.0e-12) return 1;
+			for (int j = 0; j < 4; j++)
+				std::swap(a[k][j], a[pivot][j]);
+			for (int r = k + 1; r < 3; r++) {
+				double f = a[r][k] / a[k][k];
+				for (int j = k; j < 4; j++)
+					a[r][j] -= f * a[k][j];
+			}
+		}
+		for (int k = 2; k >= 0; k--) {
+			c[k] = a[k][3];
+			for (int j = k + 1; j < 3; j++)
+				c[k] -= a[k][j] * c[j];
+			c[k] /= a[k][k];
+		}
+		return 0;
+	}
+
+	int fit_peak(const std::vector<sample> &samples, int points, double &peak, float &residual) {
+		residual = 0.0f;
+		int n = std::min(points, (int)samples.size());
+		if (samples.empty()) return 1;
+		std::vector<sample> best(samples);
+		std::partial_sort(best.begin(), best.begin() + std::max(n, 1), best.end(), [](const sample &a, const sample &b) { return a.fm > b.fm; });
+		peak = best[0].z;
+		if (n < 3 || best[0].fm <= 0.0f) return 1;	// blank frames, nothing to normalize by
+
+		bool gauss = best[n - 1].fm > 0.0f;	// a Gaussian peak is a parabola of the log measure
+		std::vector<double> x(n), y(n);
+		double lo = best[0].z, hi = best[0].z;
+		for (int i = 0; i < n; i++) {
+			x[i] = best[i].z - best[0].z;	// centered on the best sample for conditioning
+			y[i] = gauss ? std::log((double)best[i].fm) : best[i].fm / (double)best[0].fm;
+			lo = std::min(lo, best[i].z); hi = std::max(hi, best[i].z);
+		}
+		double c[3];
+		if (parabola(&x[0], &y[0], n, c) || c[2] >= 0.0) return 1;	// no maximum, keep the best sample
+		double p = best[0].z - c[1] / (2.0 * c[2]);
+		if (!std::isfinite(p) || p < lo || p > hi) return 1;	// never extrapolate past the samples, the peak is not bracketed
+
+		double sq = 0.0;
+		for (int i = 0; i < n; i++) {
+			double e = y[i] - (c[0] + c[1] * x[i] + c[2] * x[i] * x[i]);	// relative error either way
+			sq += e * e;
+		}
+		peak = p;
+		residual = (float)std::sqrt(sq / n);
+		return 0;
+	}
+
+	void search::fit() {
+		fitted = !fit_peak(samples, std::min(w.points, 5), peak, residual);
+		if (!fitted) { peak = z; residual = 0.0f; }
+	}
+
+	int search::run(strategy s, const window &win, measure_fn m) {
+		measure = m;
+		samples.clear();
+		z = 0.0; fm = 0.0f;
+		return widen(s, win);
+	}
+
+	int search::widen(strategy s, const window &win) {
+		if (win.lo > 0.0 || win.hi < 0.0 || win.step <= 0.0 || win.tolerance <= 0.0) { std::cout << "invalid autofocus search window" << std::endl; return 1; }
+		w = win;
+		limit = false; edge = 0;
+		peak = z; residual = 0.0f;
+		fitted = false;
+
+		int status;
+		if (s == HILL) status = hill();
+		else if (s == COARSE) status = coarse();
+		else if (s == GOLDEN) status = golden();
+		else { std::cout << "unknown autofocus search strategy " << s << std::endl; return 1; }
+		if (status) return 1;
+
+		double e = s == HILL ? w.step - same : w.tolerance;	// the walk stops within a step of the edge, the bracketing searches within the tolerance
+		edge = z <= w.lo + e ? -1 : (z >= w.hi - e ? 1 : 0);
+		limit = edge != 0;
+		fit();
+		return 0;
+	}
+
+	int strategy_id(const std::string &s) {
+		std::string name = s;
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = (char)std::toupper((unsigned char)name[i]);
+		int n = (int)(sizeof(names) / sizeof(names[0]));
+		for (int i = 0; i < n; i++)
+			if (name == names[i]) return i + 1;
+		if (name.empty() || name.find_first_not_of("0123456789") != std::string::npos) return 0;
+		int id = std::atoi(name.c_str());
+		return id >= 1 && id <= n ? id : 0;
+	}
+
+	std::vector<std::string> strategy_names() {
+		return std::vector<std::string>(names, names + sizeof(names) / sizeof(names[0]));
+	}
+}
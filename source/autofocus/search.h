@@ -0,0 +1,77 @@
+// autofocus search strategies along the z-drive, independent of the camera and the stage
+// a strategy only decides where to measure next, the caller's measure(z) moves the z-drive, takes a frame and returns its focus measure
+// 1. hill-climb: fixed steps down the negative arm while the measure rises, then up the positive arm if the peak was at the origin
+// 2. coarse-to-fine: climb with the coarse step, then halve the step around the best position until it reaches the tolerance
+// 3. golden-section: shrink a bracket over the whole window by the golden ratio until it is narrower than the tolerance, one frame per round
+// every position is measured at most once, the step count is the number of frames the search took
+// a search started in a narrow window around a predicted focus can be widened when the peak is not bracketed, keeping its samples
+// the peak is then interpolated from the best three to five samples, a Gaussian (parabola of the log measure) or a parabola,
+// so coarse steps still give sub-step focus, the fit residual tells how well the samples follow the model
+
+#pragma once
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <vector>
+#include <string>
+#include <functional>
+
+namespace af {
+	enum strategy {HILL = 1, COARSE, GOLDEN};	// same numbering as --afsearch
+
+	struct sample {
+		double z;	// um from the search origin
+		float fm;	// focus measure
+	};
+
+	typedef std::function<int(double z, float &fm)> measure_fn;	// move the z-drive to z um from the origin and measure a frame, 0 on success
+
+	struct window {
+		double lo;			// search range in um around the origin, lo <= 0 <= hi
+		double hi;
+		double step;		// hill-climb step, first step of coarse-to-fine
+		double tolerance;	// coarse-to-fine and golden-section stop once the peak is known to within this many um
+		int points;			// best samples the peak is fitted to, 3 to 5, 0 keeps the best sample
+
+		window() { lo = 0.0; hi = 0.0; step = 1.0; tolerance = 1.0; points = 0; }
+	};
+
+	class search {
+	private:
+		measure_fn measure;
+		window w;
+
+		int probe(double z, float &fm);	// measure a position once, revisits reuse the sample
+		int walk(int direction);		// hill-climb one arm from the origin
+		int climb(double s);			// step from the best position toward the better neighbor while the measure rises
+		int hill();
+		int coarse();
+		int golden();
+		void fit();						// interpolate the peak from the best samples
+
+	public:
+		std::vector<sample> samples;	// every measured position in order
+		double z;		// best position measured
+		float fm;		// its focus measure
+		bool limit;		// the best position is on the window edge, the peak may lie outside
+		int edge;		// -1 or 1 when the best position is on the low or high window edge, 0 inside
+		double peak;	// interpolated peak, z when no fit applies
+		float residual;	// rms fit residual, relative to the peak measure, 0 without a fit
+		bool fitted;	// peak comes from the fit
+
+		search();
+
+		int run(strategy s, const window &win, measure_fn m);
+		int widen(strategy s, const window &win);	// search again in a larger window around the same origin, measured samples are reused
+		int steps() const { return (int)samples.size(); }	// frames taken
+	};
+
+	// interpolate the focus peak from the best points samples (at least 3), 1 when they give no maximum between them and peak is the best sample
+	int fit_peak(const std::vector<sample> &samples, int points, double &peak, float &residual);
+
+	int strategy_id(const std::string &s);	// id of a strategy name or number, 0 when unknown
+	std::vector<std::string> strategy_names();	// in id order
+}
+
+#endif
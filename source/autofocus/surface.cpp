@@ -0,0 +1,93 @@
+#include "surface.h"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+namespace af {
+	surface::surface() {
+		terms = 1;
+		for (int k = 0; k < 6; k++) c[k] = 0.0;
+		cx = 0.0; cy = 0.0; scale = 1.0;
+		residual = 0.0;
+		degree = 0;
+	}
+
+	void surface::basis(double x, double y, double *p) const {
+		double u = (x - cx) / scale, v = (y - cy) / scale;
+		p[0] = 1.0; p[1] = u; p[2] = v;
+		p[3] = u * u; p[4] = u * v; p[5] = v * v;
+	}
+
+	// solve the n x n normal equations a c = b in place, 1 when singular
+	static int solve(double a[6][7], int n, double *x) {
+		for (int k = 0; k < n; k++) {	// Gaussian elimination with partial pivoting
+			int pivot = k;
+			for (int r = k + 1; r < n; r++)
+				if (std::fabs(a[r][k]) > std::fabs(a[pivot][k])) pivot = r;
+			if (std::fabs(a[pivot][k]) < 1.0e-12) return 1;
+			for (int j = 0; j <= n; j++)
+				std::swap(a[k][j], a[pivot][j]);
+			for (int r = k + 1; r < n; r++) {
+				double f = a[r][k] / a[k][k];
+				for (int j = k; j <= n; j++)
+					a[r][j] -= f * a[k][j];
+			}
+		}
+		for (int k = n - 1; k >= 0; k--) {
+			x[k] = a[k][n];
+			for (int j = k + 1; j < n; j++)
+				x[k] -= a[k][j] * x[j];
+			x[k] /= a[k][k];
+		}
+		return 0;
+	}
+
+	int surface::fit(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int max_degree) {
+		size_t n = std::min(x.size(), std::min(y.size(), z.size()));
+		if (n == 0) { std::cout << "no points to fit the focus surface to" << std::endl; return 1; }
+		cx = 0.0; cy = 0.0;
+		for (size_t i = 0; i < n; i++) { cx += x[i]; cy += y[i]; }
+		cx /= n; cy /= n;
+		scale = 0.0;
+		for (size_t i = 0; i < n; i++)
+			scale = std::max(scale, std::max(std::fabs(x[i] - cx), std::fabs(y[i] - cy)));
+		if (scale == 0.0) scale = 1.0;
+
+		static const int sizes[3] = { 1, 3, 6 };
+		for (degree = std::min(std::max(max_degree, 0), 2); degree >= 0; degree--) {	// a line of points or too few of them leave the system singular
+			terms = sizes[degree];
+			if ((size_t)terms > n) continue;
+			double a[6][7] = {};
+			for (size_t i = 0; i < n; i++) {
+				double p[6];
+				basis(x[i], y[i], p);
+				for (int r = 0; r < terms; r++) {
+					for (int k = 0; k < terms; k++)
+						a[r][k] += p[r] * p[k];
+					a[r][terms] += p[r] * z[i];
+				}
+			}
+			for (int r = 1; r < terms; r++)	// a faint ridge keeps the directions the points do not span, a single lattice row or column, flat
+				a[r][r] += 1.0e-9 * n;
+			for (int k = 0; k < 6; k++) c[k] = 0.0;
+			if (!solve(a, terms, c)) break;
+		}
+
+		double sq = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			double e = z[i] - at(x[i], y[i]);
+			sq += e * e;
+		}
+		residual = std::sqrt(sq / n);
+		return 0;
+	}
+
+	double surface::at(double x, double y) const {
+		double p[6];
+		basis(x, y, p);
+		double z = 0.0;
+		for (int k = 0; k < terms; k++)
+			z += c[k] * p[k];
+		return z;
+	}
+}
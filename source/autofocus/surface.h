@@ -0,0 +1,33 @@
+// smooth focus surface z(x, y) fitted to sparse autofocus points, e.g. a lattice of tiles focused before the scan
+// least-squares polynomial of total degree 0 (constant), 1 (plane) or 2 (quadric), too few points drop to a lower degree
+// coordinates are centered and scaled before the fit, so stage millimeters and micrometer heights stay well conditioned
+
+#pragma once
+
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <vector>
+
+namespace af {
+	class surface {
+	private:
+		int terms;		// polynomial terms in use, 1, 3 or 6
+		double c[6];	// coefficients of 1, u, v, u^2, uv, v^2 with u, v the normalized coordinates
+		double cx, cy;	// centroid of the points
+		double scale;	// half extent of the points
+
+		void basis(double x, double y, double *p) const;
+
+	public:
+		double residual;	// rms distance of the points from the surface
+		int degree;			// degree actually fitted
+
+		surface();
+
+		int fit(const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &z, int max_degree = 2);	// 1 without points
+		double at(double x, double y) const;	// surface height at (x, y)
+	};
+}
+
+#endif
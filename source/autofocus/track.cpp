@@ -0,0 +1,35 @@
+#include "track.h"
+#include <algorithm>
+
+namespace af {
+	void track::add(double t, double z) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (!times.empty() && t <= times.back()) return;	// keep the times strictly increasing
+		times.push_back(t);
+		positions.push_back(z);
+	}
+
+	int track::at(double t, double &z) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (times.empty()) return 1;
+		size_t k = std::upper_bound(times.begin(), times.end(), t) - times.begin();	// first poll after t
+		if (k == 0) z = positions.front();
+		else if (k == times.size()) z = positions.back();
+		else {
+			double f = (t - times[k - 1]) / (times[k] - times[k - 1]);
+			z = positions[k - 1] + f * (positions[k] - positions[k - 1]);
+		}
+		return 0;
+	}
+
+	void track::clear() {
+		std::lock_guard<std::mutex> guard(lock);
+		times.clear();
+		positions.clear();
+	}
+
+	size_t track::size() {
+		std::lock_guard<std::mutex> guard(lock);
+		return times.size();
+	}
+}
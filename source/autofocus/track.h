@@ -0,0 +1,27 @@
+// z-drive positions polled while the stage sweeps, stamped on the same steady clock as the camera frames
+// a frame is tagged with the position interpolated at the middle of its exposure, so no frame waits for the stage to settle
+
+#pragma once
+
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <vector>
+#include <mutex>
+
+namespace af {
+	class track {
+	private:
+		std::mutex lock;			// the poller adds while the frames are tagged
+		std::vector<double> times;	// poll times in seconds, increasing
+		std::vector<double> positions;
+
+	public:
+		void add(double t, double z);		// record a polled position, thread safe
+		int at(double t, double &z);		// position at time t, linear between polls and held before the first and after the last, 1 without polls
+		void clear();
+		size_t size();
+	};
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "demosaic.h"
+#include "../simd.h"
+#include <vector>
+#include <algorithm>
+
+namespace color {
+	// mirror an index at the frame border without repeating the edge, which keeps the Bayer parity
+	static inline int reflect(int i, int n) {
+		if (i < 0) return -i;
+		if (i >= n) return 2 * n - 2 - i;
+		return i;
+	}
+
+	static inline int clampv(int v, int maxval) {
+		return v < 0 ? 0 : (v > maxval ? maxval : v);
+	}
+
+	// red or blue row and x parity of its green pixels
+	static void classify(cfa phase, int y, bool &red, int &gp) {
+		red = (phase == CFA_RED || phase == CFA_GREEN_LEFT_OF_RED);
+		gp = (phase == CFA_GREEN_LEFT_OF_RED || phase == CFA_GREEN_LEFT_OF_BLUE) ? 0 : 1;
+		if (y & 1) {	// every other row swaps red/blue and shifts the greens
+			red = !red;
+			gp ^= 1;
+		}
+	}
+
+	// interpolate one pixel from the five rows p[0..4] centered on the current row
+	// k receives the color of the row (red or blue), o the other chroma channel
+	static inline void pixel(const unsigned short *const *p, int width, int x, bool green, dmethod m, int maxval, int &k, int &g, int &o) {
+		int w1 = reflect(x - 1, width); int e1 = reflect(x + 1, width);
+		int c = p[2][x];
+		int ch = p[2][w1] + p[2][e1];									// horizontal neighbors
+		int cv = p[1][x] + p[3][x];										// vertical neighbors
+		int dg = p[1][w1] + p[1][e1] + p[3][w1] + p[3][e1];				// diagonal neighbors
+		if (m == BILINEAR) {
+			if (green) { k = (ch + 1) >> 1; g = c; o = (cv + 1) >> 1; }
+			else { k = c; g = (ch + cv + 2) >> 2; o = (dg + 2) >> 2; }
+		}
+		else {	// Malvar-He-Cutler kernels scaled by 16
+			int rh = p[2][reflect(x - 2, width)] + p[2][reflect(x + 2, width)];	// same-color horizontal ring
+			int rv = p[0][x] + p[4][x];												// same-color vertical ring
+			if (green) {
+				k = clampv((10 * c + 8 * ch - 2 * rh - 2 * dg + rv + 8) >> 4, maxval);
+				g = c;
+				o = clampv((10 * c + 8 * cv - 2 * rv - 2 * dg + rh + 8) >> 4, maxval);
+			}
+			else {
+				k = c;
+				g = clampv((8 * c + 4 * (ch + cv) - 2 * (rh + rv) + 8) >> 4, maxval);
+				o = clampv((12 * c + 4 * dg - 3 * (rh + rv) + 8) >> 4, maxval);
+			}
+		}
+	}
+
+	static void row_scalar(const unsigned short *const *p, int width, int x0, int x1, int gp, dmethod m, int maxval, unsigned short *k, unsigned short *g, unsigned short *o) {
+		int kv, gv, ov;
+		for (int x = x0; x < x1; x++) {
+			pixel(p, width, x, (x & 1) == gp, m, maxval, kv, gv, ov);
+			k[x] = (unsigned short)kv; g[x] = (unsigned short)gv; o[x] = (unsigned short)ov;
+		}
+	}
+
+	SIMD_AVX2 static inline __m256i load8(const unsigned short *p) {	// widen 8 pixels to 32bit lanes
+		return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+	}
+
+	SIMD_AVX2 static inline void store8(unsigned short *p, __m256i v) {	// narrow 8 lanes back to 16bit, saturating at zero
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+		_mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(packed));
+	}
+
+	// 8 pixels per iteration over the interior, returns the first column left for the scalar kernel
+	SIMD_AVX2 static int row_avx2(const unsigned short *const *p, int width, int gp, dmethod m, int maxval, unsigned short *k, unsigned short *g, unsigned short *o) {
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i two = _mm256_set1_epi32(2);
+		const __m256i eight = _mm256_set1_epi32(8);
+		const __m256i vmax = _mm256_set1_epi32(maxval);
+		const __m256i green = _mm256_cmpeq_epi32(_mm256_and_si256(lanes, one), _mm256_set1_epi32(gp));	// x starts even, lane parity is x parity
+
+		int x = 2;
+		for (; x + 10 <= width; x += 8) {
+			__m256i c = load8(p[2] + x);
+			__m256i ch = _mm256_add_epi32(load8(p[2] + x - 1), load8(p[2] + x + 1));
+			__m256i cv = _mm256_add_epi32(load8(p[1] + x), load8(p[3] + x));
+			__m256i dg = _mm256_add_epi32(_mm256_add_epi32(load8(p[1] + x - 1), load8(p[1] + x + 1)), _mm256_add_epi32(load8(p[3] + x - 1), load8(p[3] + x + 1)));
+			__m256i kg, ko, gn, on;	// estimates at green pixels (kg, ko) and at red/blue pixels (gn, on)
+			if (m == BILINEAR) {
+				kg = _mm256_srli_epi32(_mm256_add_epi32(ch, one), 1);
+				ko = _mm256_srli_epi32(_mm256_add_epi32(cv, one), 1);
+				gn = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(ch, cv), two), 2);
+				on = _mm256_srli_epi32(_mm256_add_epi32(dg, two), 2);
+			}
+			else {
+				__m256i rh = _mm256_add_epi32(load8(p[2] + x - 2), load8(p[2] + x + 2));
+				__m256i rv = _mm256_add_epi32(load8(p[0] + x), load8(p[4] + x));
+				__m256i c10 = _mm256_add_epi32(_mm256_slli_epi32(c, 3), _mm256_slli_epi32(c, 1));
+				__m256i d2 = _mm256_slli_epi32(dg, 1);
+				kg = _mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(c10, _mm256_slli_epi32(ch, 3)), _mm256_slli_epi32(rh, 1)), d2), _mm256_add_epi32(rv, eight));
+				ko = _mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(c10, _mm256_slli_epi32(cv, 3)), _mm256_slli_epi32(rv, 1)), d2), _mm256_add_epi32(rh, eight));
+				__m256i ring = _mm256_add_epi32(rh, rv);
+				gn = _mm256_add_epi32(_mm256_sub_epi32(_mm256_add_epi32(_mm256_slli_epi32(c, 3), _mm256_slli_epi32(_mm256_add_epi32(ch, cv), 2)), _mm256_slli_epi32(ring, 1)), eight);
+				on = _mm256_add_epi32(_mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(c, 3), _mm256_slli_epi32(c, 2)), _mm256_slli_epi32(dg, 2)), _mm256_add_epi32(_mm256_slli_epi32(ring, 1), ring)), eight);
+				kg = _mm256_srai_epi32(kg, 4); ko = _mm256_srai_epi32(ko, 4);
+				gn = _mm256_srai_epi32(gn, 4); on = _mm256_srai_epi32(on, 4);
+			}
+			__m256i kv = _mm256_blendv_epi8(c, kg, green);
+			__m256i gv = _mm256_blendv_epi8(gn, c, green);
+			__m256i ov = _mm256_blendv_epi8(on, ko, green);
+			store8(k + x, _mm256_min_epi32(kv, vmax));	// negative lanes saturate to zero while packing
+			store8(g + x, _mm256_min_epi32(gv, vmax));
+			store8(o + x, _mm256_min_epi32(ov, vmax));
+		}
+		return x;
+	}
+
+	void demosaic_row(const unsigned short *in, int width, int height, int y, cfa phase, int bit_depth, dmethod m, unsigned short *r, unsigned short *g, unsigned short *b, bool vector) {
+		const unsigned short *p[5];
+		for (int i = 0; i < 5; i++)
+			p[i] = in + (size_t)reflect(y + i - 2, height) * width;
+		bool red; int gp;
+		classify(phase, y, red, gp);
+		unsigned short *k = red ? r : b;	// chroma sampled in this row
+		unsigned short *o = red ? b : r;	// chroma sampled in the neighbor rows
+		int maxval = (1 << bit_depth) - 1;
+
+		if (vector && simd::avx2() && width >= 12) {
+			row_scalar(p, width, 0, 2, gp, m, maxval, k, g, o);
+			int x = row_avx2(p, width, gp, m, maxval, k, g, o);
+			row_scalar(p, width, x, width, gp, m, maxval, k, g, o);
+		}
+		else
+			row_scalar(p, width, 0, width, gp, m, maxval, k, g, o);
+	}
+
+	void demosaic(const unsigned short *in, unsigned short *out, int width, int height, cfa phase, int bit_depth, dmethod m, stim::threadpool *pool) {
+		if (!pool) pool = &stim::shared_pool();
+		int bands = std::min(height, pool->size() * 4);	// a few bands per thread balances uneven finishing times
+		int rows = (height + bands - 1) / bands;
+		pool->run(bands, [&](int band) {
+			std::vector<unsigned short> planes((size_t)width * 3);	// planar scratch rows stay in cache
+			unsigned short *r = &planes[0]; unsigned short *g = r + width; unsigned short *b = g + width;
+			int y1 = std::min(height, (band + 1) * rows);
+			for (int y = band * rows; y < y1; y++) {
+				demosaic_row(in, width, height, y, phase, bit_depth, m, r, g, b);
+				unsigned short *o = out + (size_t)y * width * 3;
+				for (int x = 0; x < width; x++) {	// interleave into RGB pixels
+					o[x * 3 + 0] = r[x];
+					o[x * 3 + 1] = g[x];
+					o[x * 3 + 2] = b[x];
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,26 @@
+// Bayer demosaicking independent of the Thorlabs demosaic dll
+// 1. bilinear interpolation
+// 2. Malvar-He-Cutler gradient-corrected linear interpolation
+// scalar and AVX2 kernels, rows are processed in bands on the shared thread pool
+
+#pragma once
+
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include "../threadpool.h"
+
+namespace color {
+	enum dmethod {BILINEAR, MHC};
+
+	// color filter array phase of the origin pixel, same order as TL_COLOR_FILTER_ARRAY_PHASE
+	enum cfa {CFA_RED, CFA_BLUE, CFA_GREEN_LEFT_OF_RED, CFA_GREEN_LEFT_OF_BLUE};
+
+	// interpolate row y into planar red, green and blue rows of width pixels
+	void demosaic_row(const unsigned short *in, int width, int height, int y, cfa phase, int bit_depth, dmethod m, unsigned short *r, unsigned short *g, unsigned short *b, bool vector = true);
+
+	// demosaic a full frame into interleaved 48bit RGB
+	void demosaic(const unsigned short *in, unsigned short *out, int width, int height, cfa phase, int bit_depth, dmethod m = BILINEAR, stim::threadpool *pool = 0);
+}
+
+#endif
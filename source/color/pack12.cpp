@@ -0,0 +1,80 @@
+#include "pack12.h"
+#include "../simd.h"
+
+namespace color {
+	static void pack12_scalar(const unsigned short *in, unsigned char *out, size_t x, size_t n) {
+		for (; x + 2 <= n; x += 2) {
+			unsigned int a = in[x] & 0xfff, b = in[x + 1] & 0xfff;
+			unsigned char *o = out + x / 2 * 3;
+			o[0] = (unsigned char)a;
+			o[1] = (unsigned char)((a >> 8) | (b << 4));
+			o[2] = (unsigned char)(b >> 4);
+		}
+		if (x < n) {	// odd pixel count, the last pixel takes a byte and a half
+			unsigned int a = in[x] & 0xfff;
+			unsigned char *o = out + x / 2 * 3;
+			o[0] = (unsigned char)a;
+			o[1] = (unsigned char)(a >> 8);
+		}
+	}
+
+	static void unpack12_scalar(const unsigned char *in, unsigned short *out, size_t x, size_t n) {
+		for (; x + 2 <= n; x += 2) {
+			const unsigned char *i = in + x / 2 * 3;
+			out[x] = (unsigned short)(i[0] | ((i[1] & 0x0f) << 8));
+			out[x + 1] = (unsigned short)((i[1] >> 4) | (i[2] << 4));
+		}
+		if (x < n) {
+			const unsigned char *i = in + x / 2 * 3;
+			out[x] = (unsigned short)(i[0] | ((i[1] & 0x0f) << 8));
+		}
+	}
+
+	// 16 pixels -> 24 bytes per step: a + 4096 b per 32bit lane, then drop the top byte of every lane
+	// each step stores 28 bytes, so the loop stops while a full block of slack is left
+	SIMD_AVX2 static size_t pack12_avx2(const unsigned short *in, unsigned char *out, size_t n) {
+		const __m256i weights = _mm256_set1_epi32(0x10000001);	// (1, 4096) per pixel pair
+		const __m256i mask = _mm256_set1_epi16(0x0fff);
+		const __m256i squeeze = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		size_t x = 0;
+		for (; x + 32 <= n; x += 16) {
+			__m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(in + x)), mask);
+			v = _mm256_shuffle_epi8(_mm256_madd_epi16(v, weights), squeeze);
+			unsigned char *o = out + x / 2 * 3;
+			_mm_storeu_si128((__m128i*)o, _mm256_castsi256_si128(v));
+			_mm_storeu_si128((__m128i*)(o + 12), _mm256_extracti128_si256(v, 1));
+		}
+		return x;
+	}
+
+	// 24 bytes -> 16 pixels per step: spread every 3 bytes over a 32bit lane, then split it into two 12bit words
+	// each step loads 28 bytes, so the loop stops while a full block of slack is left
+	SIMD_AVX2 static size_t unpack12_avx2(const unsigned char *in, unsigned short *out, size_t n) {
+		const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i lo = _mm256_set1_epi32(0x00000fff);
+		const __m256i hi = _mm256_set1_epi32(0x0fff0000);
+		size_t x = 0;
+		for (; x + 32 <= n; x += 16) {
+			const unsigned char *i = in + x / 2 * 3;
+			__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)i)), _mm_loadu_si128((const __m128i*)(i + 12)), 1);
+			v = _mm256_shuffle_epi8(v, spread);
+			v = _mm256_or_si256(_mm256_and_si256(v, lo), _mm256_and_si256(_mm256_slli_epi32(v, 4), hi));
+			_mm256_storeu_si256((__m256i*)(out + x), v);
+		}
+		return x;
+	}
+
+	void pack12(const unsigned short *in, unsigned char *out, size_t n, bool vector) {
+		size_t x = 0;
+		if (vector && simd::avx2())
+			x = pack12_avx2(in, out, n);
+		pack12_scalar(in, out, x, n);
+	}
+
+	void unpack12(const unsigned char *in, unsigned short *out, size_t n, bool vector) {
+		size_t x = 0;
+		if (vector && simd::avx2())
+			x = unpack12_avx2(in, out, n);
+		unpack12_scalar(in, out, x, n);
+	}
+}
@@ -0,0 +1,19 @@
+// 12bit packed pixel storage: two pixels in three bytes, little endian
+// byte 0 = a[7:0], byte 1 = b[3:0] a[11:8], byte 2 = b[11:4]
+// scalar and AVX2 kernels, a 12bit frame costs 25% less memory and disk bandwidth than unsigned short
+
+#pragma once
+
+#ifndef PACK12_H
+#define PACK12_H
+
+#include <cstddef>
+
+namespace color {
+	inline size_t packed12_size(size_t n) { return (n * 3 + 1) / 2; }	// bytes holding n pixels
+
+	void pack12(const unsigned short *in, unsigned char *out, size_t n, bool vector = true);	// pixels above 4095 lose their high bits
+	void unpack12(const unsigned char *in, unsigned short *out, size_t n, bool vector = true);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include "params.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+namespace color {
+	params::params() {
+		width = 0;
+		height = 0;
+		bit_depth = 12;
+		phase = CFA_RED;
+		for (int i = 0; i < 9; i++) {
+			white_balance[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+			color_correction[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+		}
+	}
+
+	int params::save(std::string filename) const {
+		std::ofstream file(filename.c_str());
+		if (!file) { std::cout << "failed to write " << filename << std::endl; return 1; }
+		file << "width " << width << std::endl;
+		file << "height " << height << std::endl;
+		file << "bit_depth " << bit_depth << std::endl;
+		file << "cfa_phase " << (int)phase << std::endl;
+		file << "white_balance";
+		for (int i = 0; i < 9; i++) file << " " << white_balance[i];
+		file << std::endl;
+		file << "color_correction";
+		for (int i = 0; i < 9; i++) file << " " << color_correction[i];
+		file << std::endl;
+
+		return 0;
+	}
+
+	int params::load(std::string filename) {
+		std::ifstream file(filename.c_str());
+		if (!file) return 1;
+		std::string line;
+		while (std::getline(file, line)) {
+			std::stringstream ss(line);
+			std::string key;
+			ss >> key;
+			if (key == "width") ss >> width;
+			else if (key == "height") ss >> height;
+			else if (key == "bit_depth") ss >> bit_depth;
+			else if (key == "cfa_phase") { int p; ss >> p; phase = (cfa)p; }
+			else if (key == "white_balance") { for (int i = 0; i < 9; i++) ss >> white_balance[i]; }
+			else if (key == "color_correction") { for (int i = 0; i < 9; i++) ss >> color_correction[i]; }
+		}
+		if (width <= 0 || height <= 0) { std::cout << "invalid frame size in " << filename << std::endl; return 1; }
+
+		return 0;
+	}
+}
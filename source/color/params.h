@@ -0,0 +1,26 @@
+// color development parameters stored next to raw Bayer frames, so they can be developed offline
+
+#pragma once
+
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <string>
+#include "demosaic.h"
+
+namespace color {
+	struct params {
+		int width;					// frame width in pixels
+		int height;					// frame height in pixels
+		int bit_depth;				// significant bits per pixel
+		cfa phase;					// color filter array phase of the origin pixel
+		float white_balance[9];		// white balance matrix, applied first
+		float color_correction[9];	// color correction matrix
+
+		params();
+		int save(std::string filename) const;	// write as "key values" text lines
+		int load(std::string filename);			// read a file written by save()
+	};
+}
+
+#endif
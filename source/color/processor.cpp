@@ -0,0 +1,139 @@
+#include "processor.h"
+#include "../simd.h"
+#include <cmath>
+#include <algorithm>
+
+namespace color {
+	void srgb_lut(int bit_depth, int *lut) {
+		int maxval = (1 << bit_depth) - 1;
+		for (int i = 0; i <= maxval; i++) {
+			double v = (double)i / maxval;
+			v = (v <= 0.0031308) ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+			lut[i] = (unsigned short)(v * maxval);
+		}
+	}
+
+	processor::processor() {
+		bit_depth = 12;
+		phase = CFA_RED;
+		method = MHC;
+		shift = 14;
+		for (int i = 0; i < 9; i++)
+			matrix[i] = (i % 4 == 0) ? (1 << shift) : 0;
+	}
+
+	void processor::configure(int depth, cfa p, const float *white_balance, const float *color_correction, dmethod m) {
+		bit_depth = depth;
+		phase = p;
+		method = m;
+		shift = std::min(14, 26 - bit_depth);	// keeps three products of a 8.0 coefficient and a full-scale pixel inside 32bit
+		for (int i = 0; i < 3; i++)				// white balance first, then color correction, same order as the sdk matrix append
+			for (int j = 0; j < 3; j++) {
+				double v = 0.0;
+				for (int k = 0; k < 3; k++)
+					v += (double)color_correction[i * 3 + k] * white_balance[k * 3 + j];
+				matrix[i * 3 + j] = (int)std::lround(v * (1 << shift));
+			}
+
+		int size = 1 << bit_depth;
+		lut_48.resize(size);
+		lut_24.resize(size);
+		srgb_lut(bit_depth, &lut_48[0]);
+		for (int i = 0; i < size; i++)	// fold the 8bit reduction into the 24bit table
+			lut_24[i] = bit_depth >= 8 ? lut_48[i] >> (bit_depth - 8) : lut_48[i] << (8 - bit_depth);
+	}
+
+	static void grade_scalar(const int *matrix, int shift, int maxval, const int *lut, int x0, int x1, unsigned short *r, unsigned short *g, unsigned short *b) {
+		int round = 1 << (shift - 1);
+		for (int x = x0; x < x1; x++) {
+			int in[3] = { r[x], g[x], b[x] };
+			int out[3];
+			for (int c = 0; c < 3; c++) {
+				int v = (matrix[c * 3 + 0] * in[0] + matrix[c * 3 + 1] * in[1] + matrix[c * 3 + 2] * in[2] + round) >> shift;
+				out[c] = lut[v < 0 ? 0 : (v > maxval ? maxval : v)];
+			}
+			r[x] = (unsigned short)out[0]; g[x] = (unsigned short)out[1]; b[x] = (unsigned short)out[2];
+		}
+	}
+
+	// fixed-point 3x3 matrix, clamp and LUT gather on 8 pixels per step, returns the first column left for the scalar kernel
+	SIMD_AVX2 static int grade_avx2(const int *matrix, int shift, int maxval, const int *lut, int width, unsigned short *r, unsigned short *g, unsigned short *b) {
+		__m256i m[9];
+		for (int i = 0; i < 9; i++)
+			m[i] = _mm256_set1_epi32(matrix[i]);
+		const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i vmax = _mm256_set1_epi32(maxval);
+		unsigned short *planes[3] = { r, g, b };
+
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i in[3];
+			for (int c = 0; c < 3; c++)
+				in[c] = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(planes[c] + x)));
+			for (int c = 0; c < 3; c++) {
+				__m256i v = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(m[c * 3 + 0], in[0]), _mm256_mullo_epi32(m[c * 3 + 1], in[1])), _mm256_add_epi32(_mm256_mullo_epi32(m[c * 3 + 2], in[2]), round));
+				v = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(v, shift), zero), vmax);
+				v = _mm256_i32gather_epi32(lut, v, 4);
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+				_mm_storeu_si128((__m128i*)(planes[c] + x), _mm256_castsi256_si128(packed));
+			}
+		}
+		return x;
+	}
+
+	void processor::develop_row(const unsigned short *in, int width, int height, int y, unsigned short *r, unsigned short *g, unsigned short *b, const int *lut, bool vector) const {
+		demosaic_row(in, width, height, y, phase, bit_depth, method, r, g, b, vector);
+		int maxval = (1 << bit_depth) - 1;
+		int x = 0;
+		if (vector && simd::avx2())
+			x = grade_avx2(matrix, shift, maxval, lut, width, r, g, b);
+		grade_scalar(matrix, shift, maxval, lut, x, width, r, g, b);
+	}
+
+	static const int strip_rows = 32;	// rows per strip handed to the strip callback, still in cache when it runs
+
+	// run develop(y, r, g, b) over row bands, each band owns three planar scratch rows
+	template<typename F>
+	static void bands(int height, int width, stim::threadpool *pool, const strip_fn &strip, F develop) {
+		if (!pool) pool = &stim::shared_pool();
+		int n = std::min(height, pool->size() * 4);
+		int rows = (height + n - 1) / n;
+		pool->run(n, [&](int band) {
+			std::vector<unsigned short> planes((size_t)width * 3);	// the only scratch, three rows wide
+			int y1 = std::min(height, (band + 1) * rows);
+			int s = band * rows;	// first row of the open strip
+			for (int y = band * rows; y < y1; y++) {
+				develop(y, &planes[0], &planes[width], &planes[2 * width]);
+				if (strip && (y + 1 - s == strip_rows || y + 1 == y1)) {
+					strip(s, y + 1);
+					s = y + 1;
+				}
+			}
+		});
+	}
+
+	void processor::transform_24(const unsigned short *in, unsigned char *out, int width, int height, stim::threadpool *pool, bool vector, const strip_fn &strip) const {
+		bands(height, width, pool, strip, [&](int y, unsigned short *r, unsigned short *g, unsigned short *b) {
+			develop_row(in, width, height, y, r, g, b, &lut_24[0], vector);
+			unsigned char *o = out + (size_t)y * width * 3;
+			for (int x = 0; x < width; x++) {
+				o[x * 3 + 0] = (unsigned char)r[x];
+				o[x * 3 + 1] = (unsigned char)g[x];
+				o[x * 3 + 2] = (unsigned char)b[x];
+			}
+		});
+	}
+
+	void processor::transform_48(const unsigned short *in, unsigned short *out, int width, int height, stim::threadpool *pool, bool vector, const strip_fn &strip) const {
+		bands(height, width, pool, strip, [&](int y, unsigned short *r, unsigned short *g, unsigned short *b) {
+			develop_row(in, width, height, y, r, g, b, &lut_48[0], vector);
+			unsigned short *o = out + (size_t)y * width * 3;
+			for (int x = 0; x < width; x++) {
+				o[x * 3 + 0] = r[x];
+				o[x * 3 + 1] = g[x];
+				o[x * 3 + 2] = b[x];
+			}
+		});
+	}
+}
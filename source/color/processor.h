@@ -0,0 +1,42 @@
+// fused color processing: raw Bayer -> demosaic -> white balance & color correction -> sRGB LUT -> 24/48bit RGB
+// every row is developed completely while its planar scratch rows are in cache, no full-frame intermediate buffer
+// finished row strips can be handed to a callback while the rest of the frame is still being developed
+
+#pragma once
+
+#ifndef PROCESSOR_H
+#define PROCESSOR_H
+
+#include <vector>
+#include <functional>
+#include "demosaic.h"
+
+namespace color {
+	// sRGB companding table over [0, 2^bit_depth - 1], same curve as the Thorlabs color sdk
+	void srgb_lut(int bit_depth, int *lut);
+
+	// called with rows [y0, y1) once they are final in the output, from the pool thread that developed them, strips arrive in any order
+	typedef std::function<void(int y0, int y1)> strip_fn;
+
+	class processor {
+	private:
+		int bit_depth;				// raw pixel bit depth
+		cfa phase;					// color filter array phase of the origin pixel
+		dmethod method;				// demosaic interpolation
+		int shift;					// fixed-point precision of the color matrix
+		int matrix[9];				// color correction x white balance in fixed point, row-major
+		std::vector<int> lut_24;	// output LUT for 24bit, companding and bit depth reduction folded together
+		std::vector<int> lut_48;	// output LUT for 48bit
+
+		void develop_row(const unsigned short *in, int width, int height, int y, unsigned short *r, unsigned short *g, unsigned short *b, const int *lut, bool vector) const;
+
+	public:
+		processor();
+
+		void configure(int depth, cfa p, const float *white_balance, const float *color_correction, dmethod m = MHC);	// white balance is applied first
+		void transform_24(const unsigned short *in, unsigned char *out, int width, int height, stim::threadpool *pool = 0, bool vector = true, const strip_fn &strip = strip_fn()) const;
+		void transform_48(const unsigned short *in, unsigned short *out, int width, int height, stim::threadpool *pool = 0, bool vector = true, const strip_fn &strip = strip_fn()) const;
+	};
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "focusfile.h"
+#include <iostream>
+#include <cstring>
+
+namespace stim {
+	focusfile::focusfile() {
+		std::memset(&header, 0, sizeof(header));
+	}
+
+	focusfile::~focusfile() {
+		close();
+	}
+
+	int focusfile::create(std::string filename, int metric, int cols, int rows) {
+		close();
+		std::memcpy(header.magic, "MUSEFMAP", 8);
+		header.version = 1;
+		header.metric = metric;
+		header.cols = cols;
+		header.rows = rows;
+
+		file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file) { std::cout << "failed to create " << filename << std::endl; return 1; }
+		file.write((const char*)&header, sizeof(header));
+		file.flush();
+
+		return 0;
+	}
+
+	int focusfile::write(const tile &t, float global, const std::vector<float> &values) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (values.size() != (size_t)header.cols * header.rows) { std::cout << "focus map of tile (" << t.row << "," << t.col << "," << t.z << ") does not match the grid" << std::endl; return 1; }
+		int k[3] = { t.row, t.col, t.z };
+		file.write((const char*)k, sizeof(k));
+		file.write((const char*)&global, sizeof(global));
+		file.write((const char*)&values[0], values.size() * sizeof(float));
+		file.flush();
+		if (!file) { std::cout << "failed to write the focus map of tile (" << t.row << "," << t.col << "," << t.z << ")" << std::endl; return 1; }
+
+		return 0;
+	}
+
+	int focusfile::open(std::string filename) {
+		close();
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) { std::cout << "failed to open " << filename << std::endl; return 1; }
+		in.read((char*)&header, sizeof(header));
+		if (!in || std::memcmp(header.magic, "MUSEFMAP", 8) || header.version != 1 || header.cols <= 0 || header.rows <= 0) { std::cout << filename << " is not a focus map file" << std::endl; return 1; }
+
+		focus_entry e;
+		e.values.resize((size_t)header.cols * header.rows);
+		int k[3];
+		while (in.read((char*)k, sizeof(k)) && in.read((char*)&e.global, sizeof(e.global)) && in.read((char*)&e.values[0], e.values.size() * sizeof(float))) {	// a torn last record is ignored
+			e.row = k[0]; e.col = k[1]; e.z = k[2];
+			records.add(e);	// a repeated key resolves to the latest map
+		}
+
+		return 0;
+	}
+
+	void focusfile::close() {
+		if (file.is_open()) file.close();
+		file.clear();
+		records.clear();
+	}
+
+	const focus_entry *focusfile::find(int row, int col, int z) const {
+		return records.find(row, col, z);
+	}
+}
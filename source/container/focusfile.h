@@ -0,0 +1,54 @@
+// per-tile block focus maps of a scan: a header plus one fixed-size record per frame, keyed like the scan container
+// records are appended and flushed one by one, so a crash loses at most the last map
+// the maps let tilt fitting and best-slice selection run later without touching the frames
+
+#pragma once
+
+#ifndef FOCUSFILE_H
+#define FOCUSFILE_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "scanfile.h"
+
+namespace stim {
+	struct focus_header {			// first record of the file
+		char magic[8];				// "MUSEFMAP"
+		int version;				// file format version
+		int metric;					// focus measure id, as --fmeasure
+		int cols;					// blocks across
+		int rows;					// blocks down
+	};
+
+	struct focus_entry {			// one record per measured frame
+		int row, col, z;			// tile key
+		float global;				// focus measure of the whole frame
+		std::vector<float> values;	// cols x rows block values, row-major
+	};
+
+	class focusfile {
+	private:
+		std::ofstream file;			// append-only record file
+		std::mutex lock;			// writers share the stream
+		focus_header header;
+		tile_index<focus_entry> records;	// records of an opened file
+
+	public:
+		focusfile();
+		~focusfile();
+
+		int create(std::string filename, int metric, int cols, int rows);
+		int write(const tile &t, float global, const std::vector<float> &values);	// store the map of one frame, thread safe
+		int open(std::string filename);	// read every record of an existing file
+		void close();
+		bool is_open() const { return file.is_open(); }
+
+		const focus_header &info() const { return header; }
+		const std::vector<focus_entry> &maps() const { return records.all(); }	// in acquisition order
+		const focus_entry *find(int row, int col, int z) const;			// 0 when missing
+	};
+}
+
+#endif
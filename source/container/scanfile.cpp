@@ -0,0 +1,133 @@
+#include "scanfile.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include "../color/pack12.h"
+
+namespace stim {
+	static const unsigned int chunk_alignment = 4096;	// sector and page size, keeps chunks ready for unbuffered io
+	static const unsigned long long growth = 1ull << 30;	// bytes reserved per step, NTFS zero-fills a reservation past the written data synchronously
+
+	scanfile::scanfile() {
+		std::memset(&header, 0, sizeof(header));
+		chunks = 0;
+		expected = 0;
+		reserved = 0;
+	}
+
+	scanfile::~scanfile() {
+		close();
+	}
+
+	size_t scanfile::payload_size(pixel_layout layout, int width, int height) {
+		size_t n = (size_t)width * height;
+		switch (layout) {
+		case RGB24: return n * 3;
+		case RGB48: return n * 6;
+		case RAW16: return n * 2;
+		case RAW12: return color::packed12_size(n);
+		}
+		return 0;
+	}
+
+	int scanfile::create(std::string name, pixel_layout layout, int width, int height, size_t tiles) {
+		close();
+		std::memcpy(header.magic, "MUSESCAN", 8);
+		header.version = 1;
+		header.layout = layout;
+		header.width = width;
+		header.height = height;
+		header.payload = (unsigned int)payload_size(layout, width, height);
+		header.chunk = (header.payload + chunk_alignment - 1) / chunk_alignment * chunk_alignment;
+
+		data.open((name + ".dat").c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!data) { std::cout << "failed to create " << name << ".dat" << std::endl; return 1; }
+		expected = tiles;	// a comprehensive scan may expect hundreds of GB, reserving it all up front stalls for minutes
+		reserved = 0;
+		if (reserve()) return 1;
+
+		index.open((name + ".idx").c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!index) { std::cout << "failed to create " << name << ".idx" << std::endl; return 1; }
+		index.write((const char*)&header, sizeof(header));
+		index.flush();
+		chunks = 0;
+
+		return 0;
+	}
+
+	int scanfile::write(const tile &t, int frame, const void *payload) {
+		std::lock_guard<std::mutex> guard(lock);
+		tile_entry e;
+		e.x = t.x; e.y = t.y; e.zpos = t.zpos;
+		e.offset = chunks * header.chunk;
+		e.row = t.row; e.col = t.col; e.z = t.z;
+		e.frame = frame;
+
+		if (chunks >= reserved && reserve()) return 1;
+		data.seekp((std::streamoff)e.offset);
+		data.write((const char*)payload, header.payload);	// a scan longer than expected simply grows the file
+		data.flush();
+		if (!data) { std::cout << "failed to write tile (" << t.row << "," << t.col << "," << t.z << ")" << std::endl; return 1; }
+		chunks++;
+
+		index.write((const char*)&e, sizeof(e));	// record the chunk only once it is on disk
+		index.flush();
+		if (!index) { std::cout << "failed to index tile (" << t.row << "," << t.col << "," << t.z << ")" << std::endl; return 1; }
+
+		return 0;
+	}
+
+	int scanfile::reserve() {	// extending the file per frame fragments it, whole steps keep it in a few extents
+		unsigned long long step = std::max(1ull, growth / header.chunk);
+		unsigned long long n = std::min(expected, reserved + step);
+		if (n <= reserved) return 0;	// past the expected frames the writes simply grow the file
+		data.seekp((std::streamoff)(n * header.chunk - 1));
+		data.put(0);
+		data.flush();
+		if (!data) { std::cout << "failed to reserve room for " << n << " frames in the scan container" << std::endl; return 1; }
+		reserved = n;
+
+		return 0;
+	}
+
+	int scanfile::open(std::string name) {
+		close();
+		std::ifstream idx((name + ".idx").c_str(), std::ios::binary);
+		if (!idx) { std::cout << "failed to open " << name << ".idx" << std::endl; return 1; }
+		idx.read((char*)&header, sizeof(header));
+		if (!idx || std::memcmp(header.magic, "MUSESCAN", 8) || header.version != 1) { std::cout << name << ".idx is not a scan index" << std::endl; return 1; }
+
+		tile_entry e;
+		while (idx.read((char*)&e, sizeof(e)))	// a torn last record is ignored, a repeated key resolves to the latest frame
+			records.add(e);
+
+		data.open((name + ".dat").c_str(), std::ios::in | std::ios::binary);
+		if (!data) { std::cout << "failed to open " << name << ".dat" << std::endl; return 1; }
+		chunks = records.size();
+
+		return 0;
+	}
+
+	void scanfile::close() {
+		if (data.is_open()) data.close();
+		if (index.is_open()) index.close();
+		data.clear(); index.clear();
+		records.clear();
+		chunks = 0;
+		expected = 0;
+		reserved = 0;
+	}
+
+	const tile_entry *scanfile::find(int row, int col, int z) const {
+		return records.find(row, col, z);
+	}
+
+	int scanfile::read(const tile_entry &e, void *payload) {
+		std::lock_guard<std::mutex> guard(lock);
+		data.seekg((std::streamoff)e.offset);
+		data.read((char*)payload, header.payload);
+		if (!data) { data.clear(); std::cout << "failed to read tile (" << e.row << "," << e.col << "," << e.z << ")" << std::endl; return 1; }
+
+		return 0;
+	}
+}
@@ -0,0 +1,79 @@
+// single-file chunked scan container: one data file, reserved in 1GB steps as frames arrive, plus an append-only tile index
+// every frame takes one fixed-size, 4KB aligned chunk of <name>.dat and one index record in <name>.idx
+// the record is appended and flushed only after its chunk is on disk, so a crash loses at most the last frame
+
+#pragma once
+
+#ifndef SCANFILE_H
+#define SCANFILE_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include "tileindex.h"
+
+namespace stim {
+	enum pixel_layout {RGB24, RGB48, RAW16, RAW12};	// payload stored in every chunk
+
+	struct tile {
+		int row;		// mosaic row
+		int col;		// mosaic column, snake order already undone
+		int z;			// 0 for the frame at the tile focus (ground truth in comprehensive scans), z-stack frames count from 1
+		double x;		// stage coordinates in mm
+		double y;
+		double zpos;
+
+		tile() { row = 0; col = 0; z = 0; x = 0.0; y = 0.0; zpos = 0.0; }
+		tile(int r, int c, int k, double px, double py, double pz) { row = r; col = c; z = k; x = px; y = py; zpos = pz; }
+	};
+
+	struct scan_header {			// first record of the index file
+		char magic[8];				// "MUSESCAN"
+		int version;				// index format version
+		int layout;					// pixel_layout of the payload
+		int width;					// frame width in pixels
+		int height;					// frame height in pixels
+		unsigned int chunk;			// chunk size in bytes
+		unsigned int payload;		// frame size in bytes
+	};
+
+	struct tile_entry {				// one index record per stored frame
+		double x, y, zpos;			// stage coordinates in mm
+		unsigned long long offset;	// byte offset of the chunk in the data file
+		int row, col, z;			// tile key
+		int frame;					// acquisition index
+	};
+
+	class scanfile {
+	private:
+		std::fstream data;			// chunk file
+		std::ofstream index;		// append-only record file
+		std::mutex lock;			// writers share the two streams
+		scan_header header;
+		unsigned long long chunks;	// chunks handed out so far
+		unsigned long long expected;	// chunks the scan is expected to take, the file is never reserved past them
+		unsigned long long reserved;	// chunks the data file has room for
+
+		int reserve();				// extend the data file by one growth step
+		tile_index<tile_entry> records;	// index of an opened container
+
+	public:
+		scanfile();
+		~scanfile();
+
+		static size_t payload_size(pixel_layout layout, int width, int height);	// frame size in bytes
+
+		int create(std::string name, pixel_layout layout, int width, int height, size_t tiles);	// expect tiles frames, the file grows toward them in steps
+		int write(const tile &t, int frame, const void *payload);	// store one frame, thread safe
+		int open(std::string name);		// read the index of an existing container
+		void close();
+
+		const scan_header &info() const { return header; }
+		const std::vector<tile_entry> &tiles() const { return records.all(); }	// in acquisition order
+		const tile_entry *find(int row, int col, int z) const;				// O(1) random access, 0 when missing
+		int read(const tile_entry &e, void *payload);						// copy a frame out of the data file
+	};
+}
+
+#endif
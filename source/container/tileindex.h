@@ -0,0 +1,40 @@
+// tile key -> record lookup shared by the scan container and the focus map file
+// the key packs the mosaic row, column and z-stack index into 20 bits each, so every index resolves tiles the same way
+
+#pragma once
+
+#ifndef TILEINDEX_H
+#define TILEINDEX_H
+
+#include <vector>
+#include <unordered_map>
+
+namespace stim {
+	template<typename E>	// record type with row, col and z members
+	class tile_index {
+	private:
+		std::vector<E> entries;									// records in the order they were added
+		std::unordered_map<unsigned long long, size_t> lookup;	// tile key -> entry
+
+	public:
+		static unsigned long long key(int row, int col, int z) {
+			return ((unsigned long long)(row & 0xfffff) << 40) | ((unsigned long long)(col & 0xfffff) << 20) | (unsigned long long)((z + 1) & 0xfffff);
+		}
+
+		void add(const E &e) {	// a repeated key resolves to the latest record
+			lookup[key(e.row, e.col, e.z)] = entries.size();
+			entries.push_back(e);
+		}
+
+		const E *find(int row, int col, int z) const {	// 0 when missing
+			typename std::unordered_map<unsigned long long, size_t>::const_iterator it = lookup.find(key(row, col, z));
+			return it == lookup.end() ? 0 : &entries[it->second];
+		}
+
+		void clear() { entries.clear(); lookup.clear(); }
+		size_t size() const { return entries.size(); }
+		const std::vector<E> &all() const { return entries; }
+	};
+}
+
+#endif
@@ -0,0 +1,176 @@
+// Offline color development of raw MUSE scans
+// develops the raw Bayer frames stored by muse-scan --raw (16bit tif or 12bit packed) with the same fused processing used during acquisition
+
+
+// LIBRARY INCLUDE
+// STL include
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <io.h>
+
+// STIM include
+#include <stim/parser/arguments.h>
+#include <stim/parser/filename.h>
+#include <stim/image/image.h>
+
+// Project include
+#include "../color/processor.h"
+#include "../color/params.h"
+#include "../color/pack12.h"
+#include "../container/scanfile.h"
+#include "../threadpool.h"
+
+
+// GLOBAL VARIABLES
+stim::arglist args;				// user arguments
+std::string format;				// output format
+bool compression = false;		// flag indicates bit depth compression
+color::dmethod method = color::MHC;	// demosaic interpolation
+
+// GLOBAL FUNCTIONS
+// develop a raw scan container into <dir>/developed.dat and .idx, keeping every tile key and stage position
+int develop_container(std::string dir, const color::params &p, const color::processor &developer) {
+	stim::scanfile in;
+	if (in.open(dir + "/scan")) return 1;
+	const stim::scan_header &h = in.info();
+	if (h.layout != stim::RAW12 && h.layout != stim::RAW16) { std::cout << dir << "/scan holds no raw frames" << std::endl; return 1; }
+	if (h.width != p.width || h.height != p.height) { std::cout << dir << "/scan does not match develop.txt" << std::endl; return 1; }
+
+	stim::pixel_layout layout = compression ? stim::RGB24 : stim::RGB48;
+	stim::scanfile out;
+	if (out.create(dir + "/developed", layout, p.width, p.height, in.tiles().size())) return 1;
+	std::cout << dir << ": " << in.tiles().size() << " raw tiles" << std::endl;
+
+	std::atomic<int> failed(0);
+	stim::shared_pool().run((int)in.tiles().size(), [&](int i) {	// one tile per task, reads and writes are serialized by the containers
+		const stim::tile_entry &e = in.tiles()[i];
+		size_t n = (size_t)p.width * p.height;
+		std::vector<unsigned char> payload(h.payload);
+		std::vector<unsigned short> I(n);
+		std::vector<unsigned char> O(stim::scanfile::payload_size(layout, p.width, p.height));
+		if (in.read(e, &payload[0])) { failed++; return; }
+		if (h.layout == stim::RAW12)
+			color::unpack12(&payload[0], &I[0], n);
+		else
+			std::memcpy(&I[0], &payload[0], n * sizeof(unsigned short));
+		if (compression)
+			developer.transform_24(&I[0], &O[0], p.width, p.height);
+		else
+			developer.transform_48(&I[0], (unsigned short*)&O[0], p.width, p.height);
+		if (out.write(stim::tile(e.row, e.col, e.z, e.x, e.y, e.zpos), e.frame, &O[0])) failed++;
+	});
+
+	return failed ? 1 : 0;
+}
+// develop every raw frame of one scan directory, frames are spread over the shared pool
+int develop(std::string dir) {
+	color::params p;
+	if (p.load(dir + "/develop.txt") && p.load(dir + "/../develop.txt")) {	// comprehensive scans keep their frames one level down
+		std::cout << "no develop.txt found for " << dir << std::endl;
+		return 1;
+	}
+	color::processor developer;
+	developer.configure(p.bit_depth, p.phase, p.white_balance, p.color_correction, method);
+	if (std::ifstream((dir + "/scan.idx").c_str()))	// scanned with --container
+		return develop_container(dir, p, developer);
+
+	stim::filename mask(dir + "/*.raw.tif");
+	std::vector<stim::filename> files = mask.get_list();
+	stim::filename mask12(dir + "/*.raw12");		// 12bit packed frames
+	std::vector<stim::filename> files12 = mask12.get_list();
+	size_t n_tif = files.size();
+	files.insert(files.end(), files12.begin(), files12.end());
+	std::cout << dir << ": " << files.size() << " raw frames" << std::endl;
+
+	std::atomic<int> failed(0);
+	stim::shared_pool().run((int)files.size(), [&](int i) {	// one frame per task, the row bands of a frame run inline on the worker
+		std::string name = files[i].str();
+		stim::image<unsigned short> I(p.width, p.height, 1);
+		std::string out_name;
+		if ((size_t)i < n_tif) {
+			I.load(name);
+			if ((int)I.width() != p.width || (int)I.height() != p.height || I.channels() != 1) {
+				std::cout << "skipping " << name << ": frame does not match develop.txt" << std::endl;
+				failed++;
+				return;
+			}
+			out_name = name.substr(0, name.size() - 8) + "." + format;	// strip ".raw.tif"
+		}
+		else {
+			size_t n = (size_t)p.width * p.height;
+			std::vector<unsigned char> packed(color::packed12_size(n));
+			std::ifstream file(name.c_str(), std::ios::binary);
+			file.read((char*)&packed[0], packed.size());
+			if (!file) {
+				std::cout << "skipping " << name << ": frame does not match develop.txt" << std::endl;
+				failed++;
+				return;
+			}
+			color::unpack12(&packed[0], I.data(), n);
+			out_name = name.substr(0, name.size() - 6) + "." + format;	// strip ".raw12"
+		}
+		if (compression) {	// save in 24bpp
+			stim::image<unsigned char> O(p.width, p.height, 3);
+			developer.transform_24(I.data(), O.data(), p.width, p.height);
+			O.save(out_name);
+		}
+		else {				// save in 48bpp
+			stim::image<unsigned short> O(p.width, p.height, 3);
+			developer.transform_48(I.data(), O.data(), p.width, p.height);
+			O.save(out_name);
+		}
+	});
+
+	return failed ? 1 : 0;
+}
+// a scan directory and the FOV(row,col) tile directories of a comprehensive scan inside it
+std::vector<std::string> scan_dirs(std::string dir) {
+	std::vector<std::string> dirs(1, dir);
+	_finddata_t f;
+	intptr_t h = _findfirst((dir + "/FOV(*)").c_str(), &f);
+	if (h == -1) return dirs;
+	do {
+		if (f.attrib & _A_SUBDIR) dirs.push_back(dir + "/" + f.name);
+	} while (_findnext(h, &f) == 0);
+	_findclose(h);
+	return dirs;
+}
+
+
+int main(int argc, char* argv[]) {
+
+	// add user-defined arguments
+	args.add("help", "print the usage help");
+	args.add("format", "output image format", "tif", "any valid image format, ex. tif, png, bmp");			// specify the output image format, same choices as muse-scan
+	args.add("compression", "image compression: 8bit, 16bit");												// specify to apply either 8bit or 16bit bit depth
+	args.add("method", "demosaic interpolation: bilinear, MHC", "2", "any integer in [1,2]");				// specify the interpolation: 1->bilinear, 2->Malvar-He-Cutler, default to MHC
+
+	args.parse(argc, argv);	// parse the command line
+	if (args["help"].is_set() || args.nargs() == 0) {
+		std::cout << "example command: muse-develop result --format tif --compression" << std::endl << std::endl;
+		std::cout << args.str();	// print all arguments
+		std::exit(1);
+	}
+	format = args["format"].as_string();
+	compression = args["compression"].is_set();
+	int m = args["method"].as_int();
+	if (m <= 0 || m > 2) {
+		std::cout << "please specify demosaic interpolation as integer in range [1,2]" << std::endl;
+		std::exit(1);
+	}
+	method = (color::dmethod)(m - 1);
+
+	int error = 0;
+	for (size_t i = 0; i < args.nargs(); i++) {	// every positional argument is a scan directory
+		std::vector<std::string> dirs = scan_dirs(args.arg(i));
+		for (size_t d = 0; d < dirs.size(); d++)
+			error |= develop(dirs[d]);
+	}
+
+	return error;
+}
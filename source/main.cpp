@@ -12,6 +12,9 @@
 #include <vector>
 #include <chrono>
 #include <iomanip>
+#include <cmath>
+#include <thread>
+#include <atomic>
 #include "windows.h"
 
 // STIM include
@@ -31,11 +34,21 @@
 #include "tsi/thorcam.h"
 #include "a3200/stage.h"
 #include "metric/fmeasure.h"
+#include "pipeline/pipeline.h"
+#include "container/scanfile.h"
+#include "container/focusfile.h"
+#include "autofocus/search.h"
+#include "autofocus/surface.h"
+#include "autofocus/track.h"
 #include "timer.h"
 
 
 // GLOBAL VARIABLES
 stim::arglist args;		// user arguments
+stim::pipeline acquisition;	// asynchronous acquisition pipeline
+stim::scanfile store;	// single-file scan container
+stim::mosaic slide;		// streaming whole-slide BigTIFF
+stim::focusfile fmaps;	// block focus map of every stored frame
 std::string user = "";	// user name
 
 float bx0 = 0.0f; float by0 = 0.0f;					// scan origin coordinates (top-left) in mm, often set to (0,0)
@@ -52,6 +65,16 @@ std::string format;									// output format
 bool thread = false;								// flag indicates cpu multi-threading
 bool demosaic = false;								// flag indicates raw image demosaicking
 bool compression = false;							// flag indicates bit depth compression
+bool raw = false;									// flag indicates raw Bayer frames are stored and developed offline
+bool container = false;								// flag indicates frames go to one chunked scan container instead of image files
+bool rawfocus = false;								// flag indicates autofocus measures the raw Bayer frame instead of the color-processed one
+bool pyramid = false;								// flag indicates frames are stitched on the nominal grid into a tiled BigTIFF pyramid
+int focus_roi[4] = { 0, 0, -1, -1 };				// autofocus readout (width, height, x, y) in pixels, full frame by default, centered unless x and y are given
+int focus_bin = 1;									// autofocus readout binning, 1 or 2
+int map_cols = 0; int map_rows = 0;					// block focus map grid stored with every frame, 0 for none
+int depth = 4;										// number of frame buffers cycling through the acquisition pipeline
+bool stream = false;								// flag indicates the camera stays armed for the whole scan
+int fpt = 1;										// frames released per trigger in streaming mode, 0 for continuous
 int totalI = 0;										// total numbers of frames to collect
 int countI = 0;										// index of current frame
 int mode = 1;										// autofocus mode, default to quick scan
@@ -59,19 +82,27 @@ int fmm = 1;										// focus measure metric, default to glsd
 unsigned int p = 0;									// scan progress in %
 int prange = 0; int nrange = 0;						// positive and negative ranges in um, assumed to be equal
 int zssize = 0;										// z-drive step size in um
-int pcount = 0; int ncount = 0;						// z-drive positive and negative current count
 int psum = 0; int nsum = 0;							// z-drive positive and negative total count
-float previous_fm = 0.0f;							// last focus measure value
-float current_fm = 0.0f;							// current focus measure value
-bool reach_limit = false;							// flag indicates out-of-range in autofocus
-int move_count = 0;									// current step count along one arm in autofocus, reset for another arm
+int afs = 1;										// autofocus search strategy, default to hill-climb
+float aftol = 1.0f;									// autofocus search tolerance in um
+int affit = 5;										// best autofocus samples the focus peak is fitted to, 0 for the best sample
+float afsweep = 0.0f;								// autofocus sweep speed in um/s, 0 searches step by step
+float afwindow = 0.0f;								// half-width in um of the autofocus window around the predicted focus, 0 searches the whole range
+std::vector<int> afsteps;							// frames taken by the autofocus search of every tile
 DOUBLE default_position = 0.0;						// default z-drive position (start z-position)
 DOUBLE current_position = 0.0;						// current z-drive position
 DOUBLE optimal_position = 0.0;						// optimal z-drive position (end z-position)
 DOUBLE inter_position = 0.0;						// internal z-drive default position between tiles
 std::vector<DOUBLE> op;								// optimal z-drive positions
+std::vector<float> opr;								// fit residual of every optimal z-drive position, 0 when not fitted
+int lattice[2] = { 5, 5 };							// tiles across and down autofocused before a planned scan
+int surface_degree = 2;								// polynomial degree of the focus surface, 0 to 2
+af::surface zsurface;								// focus surface the planned scan follows, z in mm over the stage xy-plane
+std::vector<DOUBLE> lp;								// optimal z-drive positions of the lattice tiles, in lattice order
+int lattice_frames = 0;								// autofocus frames taken over the lattice
 
 std::chrono::seconds itime;							// acquisition time
+unsigned long long dropped = 0;						// frames dropped by the camera frame ring
 
 // GLOBAL FUNCTIONS
 // Print help
@@ -96,11 +127,15 @@ void pupdate(int &cur, int tot) {
 	p = (unsigned int)((cur * 100) / tot);
 	rtsProgressBar(p);
 }
+// mosaic position of the tile taken at x-drive count i of row j, the snake order is undone so col grows with x
+stim::tile here(int j, int i, int z, DOUBLE zpos) {
+	int col = (j % 2) == 0 ? i : xstep - i;
+	return stim::tile(j, col, z, bx0 + col * xssize, by0 - j * yssize, (double)zpos);
+}
 // collect a frame
-void collect(stim::thorcam cam, int &c, std::string suffix = "") {
-	cam.fire();			// collect a frame from buffer
+void collect(int &c, const stim::tile &t, std::string suffix = "") {
 	c++;				// frame count increment
-	cam.save(c, suffix);// save current frame to disk
+	acquisition.push(c, suffix, t);// collect a frame from buffer, color processing and saving to disk run in the background
 }
 // read input arguments
 void read_args() {
@@ -126,15 +161,93 @@ void read_args() {
 	thread = args["thread"].is_set();
 	demosaic = args["demosaic"].is_set();
 	compression = args["compression"].is_set();
+	raw = args["raw"].is_set();
+	container = args["container"].is_set();
+	pyramid = args["mosaic"].is_set();
+	rawfocus = args["rawfocus"].is_set();
+	if (pyramid && raw) {
+		std::cout << "the mosaic needs color frames, please drop either --mosaic or --raw" << std::endl;
+		std::exit(1);
+	}
+	focus_roi[0] = args["focusroi"].as_int(0); focus_roi[1] = args["focusroi"].as_int(1);
+	if (args["focusroi"].nargs() >= 4) { focus_roi[2] = args["focusroi"].as_int(2); focus_roi[3] = args["focusroi"].as_int(3); }
+	if (focus_roi[0] < 0 || focus_roi[1] < 0) {
+		std::cout << "please specify the autofocus region of interest as integers >= 0" << std::endl;
+		std::exit(1);
+	}
+	focus_bin = args["focusbin"].as_int();
+	if (focus_bin != 1 && focus_bin != 2) {
+		std::cout << "please specify autofocus binning as 1 or 2" << std::endl;
+		std::exit(1);
+	}
+	map_cols = args["focusmap"].as_int(0); map_rows = args["focusmap"].as_int(1);
+	if (map_cols < 0 || map_rows < 0 || (map_cols > 0) != (map_rows > 0) || map_cols > width / 2 || map_rows > height / 2) {
+		std::cout << "please specify the focus map grid as two integers in [1, frame size / 2], or 0 0" << std::endl;
+		std::exit(1);
+	}
+	stream = args["stream"].is_set();
+	fpt = args["trigger"].as_int();
+	if (fpt < 0 || fpt > 1) {	// a burst exposes every frame at the position of its trigger, while the stage moves between captures
+		std::cout << "please specify frames per trigger as 0 or 1" << std::endl;
+		std::exit(1);
+	}
+	depth = args["queue"].as_int();
+	if (depth <= 0) {
+		std::cout << "please specify the pipeline queue depth as integer > 0" << std::endl;
+		std::exit(1);
+	}
 	// read autofocus mode and focus measure metric
 	mode = args["mode"].as_int(); 
-	if (mode <= 0 || mode > 3) {
-		std::cout << "please specify autofocus mode as integer in range [1,3]" << std::endl;
+	if (mode <= 0 || mode > 4) {
+		std::cout << "please specify autofocus mode as integer in range [1,4]" << std::endl;
 		std::exit(1);
 	}
-	fmm = args["fmeasure"].as_int();
-	if (fmm <= 0 || fmm > 4) {
-		std::cout << "please specify focus measure metric as integer in range [1,4]" << std::endl;
+	lattice[0] = args["lattice"].as_int(0); lattice[1] = args["lattice"].as_int(1);
+	if (lattice[0] < 1 || lattice[1] < 1) {
+		std::cout << "please specify the pre-scan focus lattice as two integers > 0" << std::endl;
+		std::exit(1);
+	}
+	surface_degree = args["surface"].as_int();
+	if (surface_degree < 0 || surface_degree > 2) {
+		std::cout << "please specify the focus surface degree as integer in range [0,2]" << std::endl;
+		std::exit(1);
+	}
+	fmm = fm::metric_id(args["fmeasure"].as_string());	// registered name or number
+	if (!fmm) {
+		std::cout << "please specify focus measure metric as one of";
+		std::vector<std::string> names = fm::metric_names();
+		for (size_t k = 0; k < names.size(); k++)
+			std::cout << " " << names[k] << " (" << k + 1 << ")";
+		std::cout << std::endl;
+		std::exit(1);
+	}
+	afs = af::strategy_id(args["afsearch"].as_string());	// strategy name or number
+	if (!afs) {
+		std::cout << "please specify autofocus search as one of";
+		std::vector<std::string> names = af::strategy_names();
+		for (size_t k = 0; k < names.size(); k++)
+			std::cout << " " << names[k] << " (" << k + 1 << ")";
+		std::cout << std::endl;
+		std::exit(1);
+	}
+	aftol = (float)args["aftol"].as_float();
+	if (aftol <= 0.0f) {
+		std::cout << "please specify autofocus tolerance as real value > 0" << std::endl;
+		std::exit(1);
+	}
+	afsweep = (float)args["afsweep"].as_float();
+	if (afsweep < 0.0f) {
+		std::cout << "please specify the autofocus sweep speed as real value >= 0" << std::endl;
+		std::exit(1);
+	}
+	afwindow = (float)args["afwindow"].as_float();
+	if (afwindow < 0.0f) {
+		std::cout << "please specify the autofocus prediction window as real value >= 0" << std::endl;
+		std::exit(1);
+	}
+	affit = args["affit"].as_int();
+	if (affit != 0 && (affit < 3 || affit > 5)) {
+		std::cout << "please specify autofocus fit samples as integer in [3,5], or 0" << std::endl;
 		std::exit(1);
 	}
 	// read z-drive related parameters for autofocus
@@ -143,63 +256,202 @@ void read_args() {
 	zssize = args["zssize"].as_int();
 	psum = prange / zssize; nsum = nrange / zssize;	// compute total z-drive counts
 }
-// perform autofocus based on global focus measure along one arm (-1/+1 z-drive), default to negative arm
-int zfocus(stim::thorcam &cam, stim::A3200 &a3200, int direction = -1) {
-	pcount = 0; ncount = 0;	// reset positive and negative current count for one arm
-	
-	do {
-		if (a3200.read_position(2, current_position)) return 1;	// read current z-drive position
-		optimal_position = current_position;	// set optimal position to initial position, !this line can be deleted!
-
-		cam.fire();					// collect a frame from buffer
-		previous_fm = current_fm;	// update previous focus measure to current value
-		if (cam.d_compression)		// update current focus measure
-			current_fm = fm::eval_fm<unsigned char>(cam.output_buffer_24, width, height, (fm::fmetric)fmm);	// 24bit
-		else
-			current_fm = fm::eval_fm<unsigned short>(cam.output_buffer, width, height, (fm::fmetric)fmm);	// 48bit
-
-		if (a3200.moveby(AXISINDEX_02, (DOUBLE)(direction * zssize / 1000.0))) return 1;	// translate z-drive up or down
-		pcount++; ncount++; move_count++;	// step count increment
-
-		if (direction == 1) {	// check for boundary case in positive arm
-			if (pcount == psum) {
-				if (current_fm >= previous_fm) {
-					reach_limit = true;
-					std::cout << "positive limit reached, please specify larger autofocus range" << std::endl;
-				}
-				break;	// break if positive limit reached
-			}
-		}
-		else {	// check for boundary case in negative arm
-			if (ncount == nsum) {
-				if (current_fm >= previous_fm) {
-					reach_limit = true;
-					std::cout << "negative limit reached, please specify larger autofocus range" << std::endl;
-				}
-				break;	// break if negative limit reached
-			}
+// evaluate the global focus measure of a captured autofocus frame
+float zmeasure(stim::thorcam &cam, const stim::fslot *s) {
+	int fw = s->width, fh = s->height;	// focus profile readout, the full frame unless --focusroi or --focusbin
+	if (cam.binned())			// binning already mixed the Bayer channels, measure the readout as it is
+		return fm::eval_gray(s->data, fw, fh, (fm::fmetric)fmm);
+	if (rawfocus)				// focus measure on 2x2 superpixels, no color processing for a discarded frame
+		return fm::eval_raw(s->data, fw, fh, cam.phase(), (fm::fmetric)fmm);
+	if (cam.d_compression) {	// measure the strips while color processing writes them, the value is ready when transform() returns
+		fm::accumulator<unsigned char> acc(cam.output_buffer_24, fw, fh, (fm::fmetric)fmm);	// 24bit
+		cam.transform(s, cam.output_buffer, cam.output_buffer_24, [&](int y0, int y1) { acc.push(y0, y1); });
+		return acc.value();
+	}
+	fm::accumulator<unsigned short> acc(cam.output_buffer, fw, fh, (fm::fmetric)fmm);	// 48bit
+	cam.transform(s, cam.output_buffer, cam.output_buffer_24, [&](int y0, int y1) { acc.push(y0, y1); });
+	return acc.value();
+}
+// take one autofocus frame at the current z-drive position and evaluate its global focus measure
+int zmeasure(stim::thorcam &cam, float &value) {
+	const stim::fslot *s = cam.capture();
+	value = zmeasure(cam, s);
+	cam.release(s);
+	return 0;
+}
+// predict the optimal z-drive position of the tile at x-drive count i of row j from the tiles focused before it, 1 without a focused neighbor
+// the previous tile in the row, the tile above and the tile above the previous one span a local plane
+int predict(int j, int i, DOUBLE &z) {
+	int subx = xstep + 1;
+	auto count = [&](int row, int col) { return (row % 2) == 0 ? col : xstep - col; };	// x-drive count of a mosaic column, snake order
+	int col = here(j, i, 0, 0.0).col;
+	bool left = i > 0, up = j > 0;
+	if (left && up) {
+		DOUBLE zl = op[j * subx + i - 1];
+		DOUBLE zu = op[(j - 1) * subx + count(j - 1, col)];
+		DOUBLE zd = op[(j - 1) * subx + count(j - 1, here(j, i - 1, 0, 0.0).col)];
+		z = zl + zu - zd;
+	}
+	else if (left)
+		z = op[j * subx + i - 1];
+	else if (up)
+		z = op[(j - 1) * subx + count(j - 1, col)];
+	else
+		return 1;
+	return 0;
+}
+// sweep the z-drive through [lo, hi] um around the internal default position at constant speed while the camera streams
+// every frame is tagged with the z-drive position polled at the middle of its exposure, the samples end up in s as if searched
+int zsweep(stim::thorcam &cam, stim::A3200 &a3200, double lo, double hi, af::search &s, DOUBLE &optimal) {
+	double delay;
+	if (cam.delay(delay)) return 1;
+	if (a3200.moveto(AXISMASK_02, inter_position + (DOUBLE)(lo / 1000.0))) return 1;	// upward from the low end of the window
+	if (cam.stream(0)) return 1;	// continuous delivery for the whole sweep
+	double begin = stim::seconds();	// frames exposed before are left over from the previous readout
+	if (a3200.start_moveby(AXISINDEX_02, (DOUBLE)((hi - lo) / 1000.0), (DOUBLE)(afsweep / 1000.0))) return 1;
+
+	af::track path;
+	std::atomic<bool> moving(true);
+	double last = 0.0;	// time of the last poll, written before moving drops
+	double timeout = stim::seconds() + 2.0 * (hi - lo) / afsweep + 1.0;	// a faulted axis may never report done
+	std::thread poller([&]() {	// the only thread talking to the stage until the sweep ends
+		bool finished = false;
+		DOUBLE z;
+		while (!finished && stim::seconds() < timeout) {
+			if (a3200.done(AXISMASK_02, finished)) break;	// checked first, the last position polled is the settled one
+			if (a3200.read_position(2, z)) break;
+			path.add(last = stim::seconds(), (double)z);
+			Sleep(1);
 		}
-		if (current_fm >= previous_fm)
-			optimal_position = current_position;	// update optimal position to current value to generate height map
-	} while (current_fm >= previous_fm);
+		moving = false;
+	});
+	std::vector<std::pair<double, float> > stamped;	// exposure middle and focus measure of every frame
+	bool stalled = false;
+	for (;;) {	// measuring may lag behind the stream, the frames still queued at the end of the sweep are drained
+		const stim::fslot *f = cam.next(timeout + 1.0);	// the drain ends at most a second after the stage gives up
+		if (!f) { stalled = true; break; }
+		double t = f->stamp - delay;
+		bool after = !moving && t > last;	// exposed after the axis stopped
+		if (t >= begin && !after)
+			stamped.push_back(std::make_pair(t, zmeasure(cam, f)));
+		cam.release(f);
+		if (after) break;
+	}
+	poller.join();
+	if (stalled) {
+		std::cout << "the camera stopped delivering frames during the autofocus sweep" << std::endl;
+		cam.disarm();
+		return 1;
+	}
+	if (a3200.wait(AXISMASK_02)) return 1;
+	cam.disarm();
+	if (cam.focus(false)) return 1;	// full readout while still disarmed
+	if (stream && cam.stream(fpt)) return 1;	// re-arm once, back to the streaming mode of the scan
+
+	s.samples.clear();
+	float lowest = 0.0f;
+	size_t best = 0;
+	for (size_t k = 0; k < stamped.size(); k++) {
+		double z;
+		if (path.at(stamped[k].first, z)) break;
+		af::sample p = { (z - inter_position) * 1000.0, stamped[k].second };
+		s.samples.push_back(p);
+		if (s.samples.size() == 1 || p.fm > s.fm) { s.z = p.z; s.fm = p.fm; best = s.samples.size() - 1; }
+		if (s.samples.size() == 1 || p.fm < lowest) lowest = p.fm;
+	}
+	if (s.samples.empty()) { std::cout << "no frame was tagged during the autofocus sweep" << std::endl; return 1; }
+	int top = 0;	// the peak region, samples above half the measure range, and at least the --affit best
+	for (size_t k = 0; k < s.samples.size(); k++)
+		if (s.samples[k].fm >= 0.5f * (lowest + s.fm)) top++;
+	s.fitted = affit && !af::fit_peak(s.samples, (std::max)(top, affit), s.peak, s.residual);
+	if (!s.fitted) { s.peak = s.z; s.residual = 0.0f; }
+	s.edge = best == 0 ? -1 : (best + 1 == s.samples.size() ? 1 : 0);	// the first or last frame of the sweep
+	s.limit = s.edge != 0;
+	if (s.limit)
+		std::cout << "autofocus range limit reached, please specify larger autofocus range" << std::endl;
+	optimal = inter_position + (DOUBLE)(s.peak / 1000.0);
 
 	return 0;
 }
-// perform global autofocus scan
-int autofocus(stim::thorcam &cam, stim::A3200 &a3200) {
-	move_count = 0;	// reset autofocus translation count for good-roughness scan
-	previous_fm = 0.0f;	current_fm = 0.0f;	// reset history focus measure values
-
-	if (zfocus(cam, a3200, -1)) return 1;	// scan first along negative arm to avoid potential collision
-	if (move_count < 3) {	// two possible cases: (1) optimal position exists in positive arm or (2) default position is optimal
-		a3200.moveto(AXISMASK_02, (DOUBLE)inter_position);			// reset to internal default position for second arm
-		previous_fm = 0.0f;	current_fm = 0.0f;	// reset focus measure values
-		if (zfocus(cam, a3200, 1)) return 1;// scan then along positive arm
+// search the focus within [-zrange, zrange] around the internal default position, starting center um away from it
+int zsearch(stim::thorcam &cam, stim::A3200 &a3200, double center, af::search &s, DOUBLE &optimal) {
+	double lo = -nrange, hi = prange;
+	double r = afwindow > 0.0f ? afwindow : (std::max)(hi - center, center - lo);	// window half-width, grows only while the peak is not bracketed
+	if (afsweep > 0.0f) {	// one sweep over the first window replaces the search
+		cam.disarm();	// the focus profile is set while disarmed, the sweep then arms its stream once
+		if (cam.focus(true)) return 1;
+		return zsweep(cam, a3200, (std::max)(center - r, lo), (std::min)(center + r, hi), s, optimal);
 	}
+	if (cam.focus(true)) return 1;	// smaller readouts for the autofocus frames
+
+	af::measure_fn measure = [&](double z, float &value) {
+		if (a3200.moveto(AXISMASK_02, inter_position + (DOUBLE)((center + z) / 1000.0))) return 1;
+		return zmeasure(cam, value);
+	};
+	for (;;) {
+		af::window w;	// relative to the search origin, clipped to the autofocus range
+		w.lo = (std::max)(-r, lo - center); w.hi = (std::min)(r, hi - center);
+		w.step = zssize; w.tolerance = aftol;
+		w.points = affit;
+		if (s.steps() ? s.widen((af::strategy)afs, w) : s.run((af::strategy)afs, w, measure)) return 1;
+		if (!(s.edge < 0 && w.lo > lo - center) && !(s.edge > 0 && w.hi < hi - center)) break;	// bracketed, or on the edge of the whole range
+		r *= 2.0;
+	}
+	if (s.limit)
+		std::cout << "autofocus range limit reached, please specify larger autofocus range" << std::endl;
+	optimal = inter_position + (DOUBLE)((center + s.peak) / 1000.0);	// interpolated between the samples unless the fit failed
+
+	return cam.focus(false);	// frames kept after the search are full frames
+}
+// perform global autofocus scan
+int autofocus(stim::thorcam &cam, stim::A3200 &a3200, int row, int col) {
+	double center = 0.0;	// search origin in um from the internal default position
+	DOUBLE expected;
+	if (afwindow > 0.0f && !predict(row, col, expected))	// start where the focused neighbors say the focus is
+		center = (std::min)((double)prange, (std::max)((double)-nrange, (double)(expected - inter_position) * 1000.0));
+	af::search s;
+	if (zsearch(cam, a3200, center, s, optimal_position)) return 1;
+	afsteps.push_back(s.steps());
+	opr.push_back(s.residual);
 
 	op.push_back(optimal_position);	// push back optimal position to list
 	if (a3200.moveto(AXISMASK_02, (DOUBLE)optimal_position)) return 1;	// set to optimal position
-	collect(cam, countI);	// collect a frame
+	collect(countI, here(row, col, 0, optimal_position));	// collect a frame
+	pupdate(countI, totalI);// update progress bar
+
+	return 0;
+}
+// autofocus a sparse lattice of tiles in snake order and fit the focus surface a planned scan follows
+int prefocus(stim::thorcam &cam, stim::A3200 &a3200) {
+	int lc = (std::min)(lattice[0], xstep + 1), lr = (std::min)(lattice[1], ystep + 1);	// never more lattice points than tiles
+	std::vector<double> px, py, pz;
+	for (int b = 0; b < lr; b++) {
+		int j = lr > 1 ? (int)std::lround((double)b * ystep / (lr - 1)) : ystep / 2;	// the lattice spans the whole grid, edges included
+		for (int a = 0; a < lc; a++) {
+			int k = (b % 2) == 0 ? a : lc - 1 - a;	// snake over the lattice
+			int col = lc > 1 ? (int)std::lround((double)k * xstep / (lc - 1)) : xstep / 2;
+			DOUBLE xy[2] = { (DOUBLE)(bx0 + col * xssize), (DOUBLE)(by0 - j * yssize) };
+			if (a3200.moveto(xy)) return 1;
+			if (a3200.read_position(2, inter_position)) return 1;	// each lattice point starts at the focus of the previous one
+			af::search s;
+			DOUBLE z;
+			if (zsearch(cam, a3200, 0.0, s, z)) return 1;
+			if (a3200.moveto(AXISMASK_02, z)) return 1;
+			px.push_back(xy[0]); py.push_back(xy[1]); pz.push_back((double)z);
+			lp.push_back(z);
+			lattice_frames += s.steps();
+		}
+	}
+	return zsurface.fit(px, py, pz, surface_degree);
+}
+// move onto a tile and the focus surface in one coordinated move and collect it
+int planned(stim::thorcam &cam, stim::A3200 &a3200, int row, int col) {
+	stim::tile t = here(row, col, 0, 0.0);
+	DOUBLE xy[2] = { (DOUBLE)t.x, (DOUBLE)t.y };
+	DOUBLE z = (DOUBLE)zsurface.at(t.x, t.y);
+	if (a3200.moveto(xy, z)) return 1;
+	op.push_back(z);	// the planned z-map
+	collect(countI, here(row, col, 0, z));	// collect a frame
 	pupdate(countI, totalI);// update progress bar
 
 	return 0;
@@ -207,7 +459,7 @@ int autofocus(stim::thorcam &cam, stim::A3200 &a3200) {
 // perform z-traverse for fusion
 int ztraverse(stim::thorcam &cam, stim::A3200 &a3200, int row, int col) {
 	if (a3200.moveto(AXISMASK_02, (DOUBLE)default_position)) return 1;		// reset to default position
-	collect(cam, countI);	// collect ground truth
+	collect(countI, here(row, col, 0, default_position));	// collect ground truth
 	if (a3200.moveby(AXISINDEX_02, (DOUBLE)(-nrange / 1000.0))) return 1;	// set to minimum position to start z-drive streaming
 	
 	int ssum = psum + nsum + 1;	// compute streaming total count
@@ -224,7 +476,7 @@ int ztraverse(stim::thorcam &cam, stim::A3200 &a3200, int row, int col) {
 	// (2,0) (2,1) (2,2)
 	
 	for (int d = 0; d < ssum; d++) {
-		collect(cam, scount, ssuffix.str());	// collect a frame and then translate z-drive produces the exactly numbers of frames requested
+		collect(scount, here(row, col, d + 1, default_position + (DOUBLE)((d * zssize - nrange) / 1000.0)), ssuffix.str());	// collect a frame and then translate z-drive produces the exactly numbers of frames requested
 		if (a3200.moveby(AXISINDEX_02, (DOUBLE)(zssize / 1000.0))) return 1;	// translate z-drive up or down
 	}
 
@@ -237,6 +489,8 @@ int scan(stim::thorcam &cam, stim::A3200 &a3200, int mode = 1) {
 	// note that this origin is often manually set to (0, 0) in the system by resetting the stage before acquisition
 	if (a3200.moveto(origin)) return 1;		// home to the lateral origin
 	if (a3200.read_position(2, default_position)) return 1;		// read current z-drive position, should be 0.0mm after reset
+	if (stream && cam.stream(fpt)) return 1;	// arm the camera once for the whole scan
+	if (mode == 4 && prefocus(cam, a3200)) return 1;	// focus surface first, the scan itself takes no autofocus frames
 
 	pupdate(countI, totalI);	// update progress
 	int i = 0;	// x-drive count
@@ -247,47 +501,73 @@ int scan(stim::thorcam &cam, stim::A3200 &a3200, int mode = 1) {
 		i = 0;	// reset x-drive count
 
 		if (mode == 1) {	// for quick scan
-			collect(cam, countI);	// collect a frame
+			collect(countI, here(j, i, 0, inter_position));	// collect a frame
 			pupdate(countI, totalI);// update progress bar
 		}
 		else if (mode == 2) {	// for good-roughness scan
-			autofocus(cam, a3200);
+			if (autofocus(cam, a3200, j, i)) return 1;
 		}
 		else if (mode == 3) {	// for comprehensive scan
 			if (ztraverse(cam, a3200, j, i)) return 1;
 			pupdate(countI, totalI);// update progress bar
 		}
+		else if (mode == 4) {	// for planned scan
+			if (planned(cam, a3200, j, i)) return 1;
+		}
 
 		int xfactor = (j % 2) == 0 ? 1 : -1;	// x-drive translation coefficient, (row j) even means right (positive) while odd means left (negative) in snake scan
 
 		for (i = 1; i < xstep + 1; i++) {
 			if (a3200.read_position(2, inter_position)) return 1;		// read current z-drive position as default, should be 0.0mm
-			if (a3200.moveby(AXISINDEX_00, (DOUBLE)xfactor * xssize)) return 1;
+			if (mode != 4 && a3200.moveby(AXISINDEX_00, (DOUBLE)xfactor * xssize)) return 1;	// the planned scan moves x, y and z together
 			//if (a3200.read_position(2, current_position)) return 1;		// read current z-drive position
 			//std::cout << "move along x-direction by " << xfactor * xssize << std::endl;
 
 			if (mode == 1) {
-				collect(cam, countI);	// collect a frame
+				collect(countI, here(j, i, 0, inter_position));	// collect a frame
 				pupdate(countI, totalI);// update progress bar
 			}
 			else if (mode == 2) {
-				if (autofocus(cam, a3200)) return 1;
+				if (autofocus(cam, a3200, j, i)) return 1;
 			}
 			else if (mode == 3) {
 				if (ztraverse(cam, a3200, j, i)) return 1;
 				pupdate(countI, totalI);// update progress bar
 			}
+			else if (mode == 4) {
+				if (planned(cam, a3200, j, i)) return 1;
+			}
 		}
 
-		if (j != ystep)		// no row translation for final row
+		if (j != ystep && mode != 4)		// no row translation for final row
 			if (a3200.moveby(AXISINDEX_01, (DOUBLE)-yssize)) return 1;																													
 	}
 
 	if (a3200.moveto(origin)) return 1;		// reset to the origin
 	if (a3200.moveto(AXISMASK_02, (DOUBLE)default_position)) return 1;		// reset to default z-drive position
+	cam.disarm();	// leave streaming mode
 
 	return 0;
 }
+// write per-tile values in snake acquisition order as a grid in row-major order
+template<typename T>
+void zmap(std::ofstream &file, const std::vector<T> &values) {
+	int subx = xstep + 1; int suby = ystep + 1;
+	for (int j = 0; j < suby; j++) {
+		for (int i = 0; i < subx; i++) {
+			int id = j * subx;		// convert from snake coordinate to normal coordinate
+			if (j % 2 == 0)
+				id += i;
+			else
+				id += subx - 1 - i;
+			file << std::fixed << std::setprecision(5) << (float)values[id];
+			if (i != subx + 1)
+				file << "   ";
+		}
+		if (j != suby + 1)
+			file << std::endl;
+	}
+}
 // saving process logs in disk
 void log(int mode = 1) {
 	std::string filename = "log.txt";
@@ -313,6 +593,13 @@ void log(int mode = 1) {
 	file << "frame:" << width << "x" << height << std::endl;
 	file << "pixel size: " << psize << "um/pixel" << std::endl;
 	file << "acquisition time: " << itime.count() << "s" << std::endl;
+	file << "dropped frames: " << dropped << std::endl;
+	if (container)
+		file << "scan container: scan.dat, scan.idx" << std::endl;
+	if (pyramid)
+		file << "mosaic: mosaic.tif" << std::endl;
+	if (map_cols > 0)
+		file << "focus maps: focus.map, " << map_cols << "x" << map_rows << " blocks" << std::endl;
 
 	if (mode == 1) {			// for quick scan
 		file << std::endl;
@@ -322,22 +609,27 @@ void log(int mode = 1) {
 		file << std::endl;
 		file << "ROOD-ROUGHNESS SCAN" << std::endl;
 		file << "auto focus z-drive range: [" << -nrange << ", " << prange << "]um, z-drive stepsize: " << zssize << "um" << std::endl;
+		file << "focus measure: " << fm::find_metric(fmm)->name << std::endl;
+		if (afsweep > 0.0f)
+			file << "auto focus sweep: " << afsweep << "um/s, peak fit: " << (affit ? "half maximum" : "off") << std::endl;
+		else
+			file << "auto focus search: " << af::strategy_names()[afs - 1] << ", tolerance: " << aftol << "um, peak fit: " << (affit ? affit : 1) << " samples" << std::endl;
+		int frames = 0;
+		for (size_t k = 0; k < afsteps.size(); k++)
+			frames += afsteps[k];
+		if (afwindow > 0.0f)
+			file << "auto focus prediction window: " << afwindow << "um" << std::endl;
+		file << "auto focus frames: " << frames << ", " << (afsteps.empty() ? 0.0f : (float)frames / afsteps.size()) << " per tile" << std::endl;
+		if (focus_roi[0] > 0 && focus_roi[1] > 0)
+			file << "auto focus readout: " << focus_roi[0] << "x" << focus_roi[1] << std::endl;
+		if (focus_bin > 1)
+			file << "auto focus binning: " << focus_bin << "x" << focus_bin << std::endl;
 		file << "default z-drive position: " << std::fixed << std::setprecision(5) << (float)default_position << "mm" << std::endl;
 		file << "auto focus z-map: " << std::endl;
-		int subx = xstep + 1; int suby = ystep + 1;
-		for (int j = 0; j < suby; j++) {
-			for (int i = 0; i < subx; i++) {
-				int id = j * subx;		// convert from snake coordinate to normal coordinate
-				if (j % 2 == 0)
-					id += i;
-				else
-					id += subx - 1 - i;
-				file << std::fixed << std::setprecision(5) << (float)op[id];
-				if (i != subx + 1)
-					file << "   ";
-			}
-			if (j != suby + 1)
-				file << std::endl;
+		zmap(file, op);
+		if (affit) {
+			file << "auto focus fit residual: " << std::endl;	// rms relative error of the peak fit, small means a confident peak
+			zmap(file, opr);
 		}
 	}
 	else if (mode == 3) {
@@ -346,6 +638,24 @@ void log(int mode = 1) {
 		file << "auto focus z-drive range: [" << -nrange << ", " << prange << "]um, z-drive stepsize: " << zssize << "um" << std::endl;
 		file << "total z-stream count: " << psum + nsum + 1 << std::endl;
 	}
+	else if (mode == 4) {		// for planned scan
+		file << std::endl;
+		file << "PLANNED SCAN" << std::endl;
+		file << "auto focus z-drive range: [" << -nrange << ", " << prange << "]um, z-drive stepsize: " << zssize << "um" << std::endl;
+		file << "focus measure: " << fm::find_metric(fmm)->name << std::endl;
+		if (afsweep > 0.0f)
+			file << "auto focus sweep: " << afsweep << "um/s, peak fit: " << (affit ? "half maximum" : "off") << std::endl;
+		else
+			file << "auto focus search: " << af::strategy_names()[afs - 1] << ", tolerance: " << aftol << "um, peak fit: " << (affit ? affit : 1) << " samples" << std::endl;
+		file << "focus lattice: " << (std::min)(lattice[0], xstep + 1) << "x" << (std::min)(lattice[1], ystep + 1) << ", " << lattice_frames << " auto focus frames" << std::endl;
+		file << "focus surface: degree " << zsurface.degree << ", rms residual " << zsurface.residual * 1000.0 << "um" << std::endl;
+		file << "default z-drive position: " << std::fixed << std::setprecision(5) << (float)default_position << "mm" << std::endl;
+		file << "lattice z-positions: " << std::endl;
+		for (size_t k = 0; k < lp.size(); k++)	// lattice snake order
+			file << (float)lp[k] << ((k + 1) % (std::min)(lattice[0], xstep + 1) ? "   " : "\n");
+		file << "planned z-map: " << std::endl;
+		zmap(file, op);
+	}
 
 	file.close();
 }
@@ -387,14 +697,33 @@ int main(int argc, char* argv[]) {
 	// |      |      |
 	// ---------------     R = a red pixel, GR = a green pixel next to a red pixel, B = a blue pixel, GB = a green pixel next to a blue pixel.
 	args.add("compression", "image compression: 8bit, 16bit");												// specify to apply either 8bit or 16bit bit depth
-	args.add("mode", "autofocus mode: quick, good-roughness, comprehensive", "1", "any integer in [1,3]");	// specify the autofocus mode: 1->quick scan, 2->good-roughness scan, 3->comprehensive scan, default to 1->quick scan
+	args.add("raw", "store raw Bayer frames, develop them later with muse-develop");							// specify to skip color processing during the scan, frames keep the full sensor bit depth
+	args.add("container", "store the whole scan in one chunked container (scan.dat, scan.idx) instead of image files");	// specify to avoid hundreds of thousands of small files in comprehensive scans
+	args.add("mosaic", "stitch the frames on the nominal scan grid into a tiled BigTIFF pyramid (mosaic.tif)");	// specify to get a slide viewable in whole-slide viewers as soon as the scan ends
+	args.add("stream", "keep the camera armed for the whole scan, triggers only release exposures");		// specify to avoid the arm/disarm round trip per frame
+	args.add("trigger", "frames released per trigger in streaming mode, 0 for continuous", "1", "0 or 1");	// continuous streaming drops the frame exposed during stage motion
+	args.add("queue", "number of frames buffered in the acquisition pipeline", "4", "any integer > 0");		// specify the frame pool size, each frame costs a raw buffer plus an output buffer in memory
+	args.add("mode", "autofocus mode: quick, good-roughness, comprehensive, planned", "1", "any integer in [1,4]");	// specify the autofocus mode: 1->quick scan, 2->good-roughness scan, 3->comprehensive scan, 4->planned scan, default to 1->quick scan
 	// quick scan: scan without autofocus -- good for mounted tissue sections
 	// good-roughness scan: scan with frame-level autofocus -- good for embedded tissue blocks
 	// comprehensive scan: scan with a stack of height map for each frame -- good for fresh tissue or biopsy
-	args.add("fmeasure", "focus measure metric: GLSD, SPFQ, BREN, HISE", "1", "any interger in [1,4]");		// specify the focus measure metric: 1->GLSD, 2->SPFQ, 3->BREN, 4->HISE, default to GLSD
+	// planned scan: autofocus a sparse lattice of tiles first, then follow the fitted focus surface -- good for embedded tissue blocks at quick scan speed
+	args.add("lattice", "tiles (across, down) autofocused before a planned scan", "5 5", "two integers > 0");	// specify the pre-scan focus lattice, spread evenly over the grid including its edges
+	args.add("surface", "polynomial degree of the focus surface of a planned scan", "2", "any integer in [0,2]");	// specify 0->constant, 1->plane, 2->quadric, fewer lattice points fall back to a lower degree
+	args.add("fmeasure", "focus measure metric: GLSD, SPFQ, BREN, HISE, TENG, LAPV, WAVR", "1", "metric name or any interger in [1,7]");	// specify the focus measure metric: 1->GLSD, 2->SPFQ, 3->BREN, 4->HISE, 5->TENG, 6->LAPV, 7->WAVR, default to GLSD
 	// GLSD->grayscale standard deviation, SPFQ->spatial frequency, BREN->Brenner's first differentiation, HISE->histogram entropy
+	// TENG->Tenengrad Sobel energy, LAPV->variance of Laplacian, WAVR->Haar wavelet detail over approximation energy
+	args.add("rawfocus", "evaluate the focus measure on the raw Bayer frame, skipping color processing");	// specify to measure autofocus frames on half-resolution superpixel luma
+	args.add("focusroi", "autofocus readout (width, height[, x, y]) in pixels, 0 0 for the full frame", "0 0", "integers >= 0, centered unless x and y are given");	// specify a smaller sensor readout for the autofocus frames, shorter readout and transfer per z-step
+	args.add("focusbin", "autofocus readout binning", "1", "1 or 2");										// specify 2x2 binning for the autofocus frames, the binned frame is measured as a single channel
+	args.add("focusmap", "store a block focus map (columns, rows) with every frame in focus.map, 0 0 for none", "0 0", "two integers >= 0, ex. 32 16");	// specify to keep where each part of the field of view is in focus, for tilt fitting and best-slice selection later
 	args.add("zrange", "define the z-drive travel distance along one arm in um", "50", "real value > 0");	// specify the z-drive travel distance along one direction, default to 50um for the Nikon 10X objective (in total 50um considering positive and negative parts)
 	args.add("zssize", "define the z-step size in um", "1", "real value > 0");								// specify the z-drive step size, default to 1um for the Nikon 10X objective
+	args.add("afsearch", "autofocus search: HILL, COARSE, GOLDEN", "1", "strategy name or any integer in [1,3]");	// specify the autofocus search: 1->hill-climb in zssize steps, 2->coarse-to-fine from zssize down to aftol, 3->golden-section down to aftol
+	args.add("aftol", "autofocus search tolerance in um", "1", "real value > 0");							// specify where coarse-to-fine and golden-section stop, ex. --afsearch 2 --zssize 8 --aftol 1
+	args.add("afsweep", "sweep the z-drive through the autofocus range at this speed in um/s while the camera streams, 0 searches step by step", "0", "real value >= 0");	// specify one continuous sweep per tile, frames are tagged with the polled z-drive position, keep the exposure short against motion blur
+	args.add("afwindow", "half-width in um of the autofocus window around the focus predicted from the neighbor tiles, 0 searches the whole range", "0", "real value >= 0");	// specify a narrow search around the plane through the focused neighbors, the window doubles until the peak is bracketed
+	args.add("affit", "best autofocus samples the focus peak is fitted to, 0 for the best sample", "5", "0 or any integer in [3,5]");	// specify the Gaussian / parabola peak fit, sub-step focus from coarse steps
 	// The lateral sampling rate is determined by the microscope while the axial sampling rate is simply determined by the z-drive step size
 	
 
@@ -406,10 +735,29 @@ int main(int argc, char* argv[]) {
 	read_args();		// read all user input parameters
 
 	stim::thorcam cam(thread, demosaic, compression);	// create a thorlabs camera object
+	cam.d_raw = raw;	// raw frames are written straight from the camera ring
+	for (int k = 0; k < 4; k++) cam.focus_roi[k] = focus_roi[k];
+	cam.focus_bin = focus_bin;
+	cam.ring_depth = depth + 2;	// pipeline frames hold ring slots until their color processing ends, keep room for the frame in flight
 	if (cam.connect(cam_expo, cam_gain, cam_bl, output_dir, format)) { cam.disconnect(); std::exit(1); }	// connect to camera via the created camera object
 	if (cam.configure()) { cam.disconnect(); std::exit(1); }	// configure camera
 	stim::A3200 a3200;									// create a A3200 stage object
 	if (a3200.connect()) { a3200.disconnect(); std::exit(1); }	// connect to stage via the created stage object
+	if (container) {	// frames are stored raw in fixed-size chunks, one per tile and z
+		_mkdir(output_dir.c_str());
+		size_t tiles = mode == 3 ? (size_t)totalI * (psum + nsum + 2) : (size_t)totalI;	// ground truth plus z-stream per tile
+		if (store.create(output_dir + "/scan", stim::pipeline::layout(cam), width, height, tiles)) { cam.disconnect(); a3200.disconnect(); std::exit(1); }
+	}
+	if (pyramid) {	// tiles are placed without registration, the step is what read_args() computed
+		_mkdir(output_dir.c_str());
+		int sx = (int)std::lround(xssize * 1000.0f / psize), sy = (int)std::lround(yssize * 1000.0f / psize);
+		if (slide.create(output_dir + "/mosaic.tif", width, height, xstep + 1, ystep + 1, sx, sy, psize)) { cam.disconnect(); a3200.disconnect(); std::exit(1); }
+	}
+	if (map_cols > 0) {	// measured on the raw frames with the autofocus metric
+		_mkdir(output_dir.c_str());
+		if (fmaps.create(output_dir + "/focus.map", fmm, map_cols, map_rows)) { cam.disconnect(); a3200.disconnect(); std::exit(1); }
+	}
+	if (acquisition.start(cam, depth, 2, container ? &store : 0, pyramid ? &slide : 0, map_cols > 0 ? &fmaps : 0)) { cam.disconnect(); a3200.disconnect(); std::exit(1); }	// spawn the acquisition pipeline workers
 
 	// hmm.....
 	system("CLS");	// print start point
@@ -420,10 +768,15 @@ int main(int argc, char* argv[]) {
 	std::cout << std::endl; Sleep(500);
 
 	timer_start();		// timer starts
-	if (scan(cam, a3200, mode)) { cam.disconnect(); a3200.disconnect(); std::exit(1); }	// perform large-scale scan
+	if (scan(cam, a3200, mode)) { acquisition.stop(); cam.disconnect(); a3200.disconnect(); std::exit(1); }	// perform large-scale scan
+	acquisition.stop();		// wait for the remaining frames to reach the disk
+	store.close();
+	slide.close();		// remaining tiles and the pyramid directories
+	fmaps.close();
 	std::cout << std::endl << "END ACQUISITION....." << std::endl;
 	itime = timer_stop<std::chrono::seconds>();	// timer stops, in seconds
 	std::cout << "it takes " << itime.count() << "s to process" << std::endl;
+	dropped = cam.dropped();
 	
 	log(mode);			// output logs
 
@@ -1,160 +1,863 @@
 #include "fmeasure.h"
+#include "../simd.h"
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
 
 namespace fm {
-	enum fmetric {GLSD, SPFQ, BREN, HISE};
-	
-	// convert from rgb to grayscale, by default using CCIR 601
-	// luma 1->CCIR 601, 2->BT.709, 3->SMPTE 240M
+	static constexpr int luma_weights[4][3] = {	// Q8 weights summing to 256, indexed by template arguments so every kernel sees constants
+		{ 77, 150, 29 },	// CCIR 601: 0.2990, 0.5870, 0.1140
+		{ 54, 183, 19 },	// BT. 709: 0.2126, 0.7152, 0.0722
+		{ 54, 180, 22 },	// SMPTE 240M: 0.2120, 0.7010, 0.0870
+		{ 0, 256, 0 },		// green channel only
+	};
+
+	static std::vector<int> &scratch(size_t n) {	// luma rows, kept per thread and reused by every call
+		static thread_local std::vector<int> rows;
+		if (rows.size() < n) rows.resize(n);
+		return rows;
+	}
+
+	void partial::add(const partial &p) {
+		n += p.n; sum += p.sum; sumsq += p.sumsq; h += p.h; v += p.v;
+		if (histogram.size() < p.histogram.size()) histogram.resize(p.histogram.size(), 0);
+		for (size_t i = 0; i < p.histogram.size(); i++)
+			histogram[i] += p.histogram[i];
+	}
+
+	// scalar reference kernels, also used for the row tails of the vector kernels
+	// luma kernels are specialized on pixel type and luma standard, the weights are immediates and GREEN is a plain copy
+	template<typename T, luma L>
+	static void luma_scalar(const T *in, int x, int width, int *out) {
+		const int w0 = luma_weights[L - 1][0], w1 = luma_weights[L - 1][1], w2 = luma_weights[L - 1][2];
+		for (; x < width; x++)
+			out[x] = L == GREEN ? in[x * 3 + 1] : (w0 * in[x * 3 + 0] + w1 * in[x * 3 + 1] + w2 * in[x * 3 + 2] + 128) >> 8;
+	}
+
+	static void moments_scalar(const int *row, int x, int width, unsigned long long &sum, unsigned long long &sumsq) {
+		for (; x < width; x++) {
+			sum += row[x];
+			sumsq += (unsigned long long)((long long)row[x] * row[x]);
+		}
+	}
+
+	static unsigned long long diff2_scalar(const int *a, const int *b, int x, int width) {	// sum of (a - b)^2
+		unsigned long long result = 0;
+		for (; x < width; x++) {
+			long long d = a[x] - b[x];
+			result += (unsigned long long)(d * d);
+		}
+		return result;
+	}
+
+	// AVX2 kernels, 8 pixels per step with 64bit lanes for every sum, each returns the first pixel left for the scalar kernel
+	// luma values stay below 2^16, so a squared difference fits the unsigned 32x32->64 multiply
+	template<typename T, luma L>
+	SIMD_AVX2 static int luma_avx2(const T *in, int width, int *out) {
+		const __m256i idx = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+		const __m256i mask = _mm256_set1_epi32(sizeof(T) == 1 ? 0xff : 0xffff);
+		const __m256i w0 = _mm256_set1_epi32(luma_weights[L - 1][0]), w1 = _mm256_set1_epi32(luma_weights[L - 1][1]), w2 = _mm256_set1_epi32(luma_weights[L - 1][2]);
+		const __m256i round = _mm256_set1_epi32(128);
+		int x = 0;
+		for (; x + 9 <= width; x += 8) {	// a gather reads 4 bytes per element, keep one pixel of slack before the row end
+			const T *p = in + x * 3;
+			__m256i g = _mm256_and_si256(_mm256_i32gather_epi32((const int*)(p + 1), idx, sizeof(T)), mask);
+			if (L == GREEN) {	// one gather instead of three
+				_mm256_storeu_si256((__m256i*)(out + x), g);
+				continue;
+			}
+			__m256i r = _mm256_and_si256(_mm256_i32gather_epi32((const int*)(p + 0), idx, sizeof(T)), mask);
+			__m256i b = _mm256_and_si256(_mm256_i32gather_epi32((const int*)(p + 2), idx, sizeof(T)), mask);
+			__m256i v = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(r, w0), _mm256_mullo_epi32(g, w1)), _mm256_add_epi32(_mm256_mullo_epi32(b, w2), round));
+			_mm256_storeu_si256((__m256i*)(out + x), _mm256_srli_epi32(v, 8));
+		}
+		return x;
+	}
+
+	SIMD_AVX2 static unsigned long long hsum_avx2(__m256i v) {
+		unsigned long long lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, v);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	SIMD_AVX2 static int moments_avx2(const int *row, int width, unsigned long long &sum, unsigned long long &sumsq) {
+		__m256i s = _mm256_setzero_si256(), q = _mm256_setzero_si256();
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(row + x));
+			__m256i odd = _mm256_srli_epi64(v, 32);
+			s = _mm256_add_epi64(s, _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1))));
+			q = _mm256_add_epi64(q, _mm256_add_epi64(_mm256_mul_epu32(v, v), _mm256_mul_epu32(odd, odd)));
+		}
+		sum += hsum_avx2(s);
+		sumsq += hsum_avx2(q);
+		return x;
+	}
+
+	SIMD_AVX2 static int diff2_avx2(const int *a, const int *b, int width, unsigned long long &result) {
+		__m256i q = _mm256_setzero_si256();
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i d = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(a + x)), _mm256_loadu_si256((const __m256i*)(b + x))));
+			__m256i odd = _mm256_srli_epi64(d, 32);
+			q = _mm256_add_epi64(q, _mm256_add_epi64(_mm256_mul_epu32(d, d), _mm256_mul_epu32(odd, odd)));
+		}
+		result += hsum_avx2(q);
+		return x;
+	}
+
+	// AVX-512 kernels, same arithmetic on 16 pixels per step
+	template<typename T, luma L>
+	SIMD_AVX512 static int luma_avx512(const T *in, int width, int *out) {
+		const __m512i idx = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45);
+		const __m512i mask = _mm512_set1_epi32(sizeof(T) == 1 ? 0xff : 0xffff);
+		const __m512i w0 = _mm512_set1_epi32(luma_weights[L - 1][0]), w1 = _mm512_set1_epi32(luma_weights[L - 1][1]), w2 = _mm512_set1_epi32(luma_weights[L - 1][2]);
+		const __m512i round = _mm512_set1_epi32(128);
+		int x = 0;
+		for (; x + 17 <= width; x += 16) {
+			const T *p = in + x * 3;
+			__m512i g = _mm512_and_si512(_mm512_i32gather_epi32(idx, (const int*)(p + 1), sizeof(T)), mask);
+			if (L == GREEN) {
+				_mm512_storeu_si512((void*)(out + x), g);
+				continue;
+			}
+			__m512i r = _mm512_and_si512(_mm512_i32gather_epi32(idx, (const int*)(p + 0), sizeof(T)), mask);
+			__m512i b = _mm512_and_si512(_mm512_i32gather_epi32(idx, (const int*)(p + 2), sizeof(T)), mask);
+			__m512i v = _mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(r, w0), _mm512_mullo_epi32(g, w1)), _mm512_add_epi32(_mm512_mullo_epi32(b, w2), round));
+			_mm512_storeu_si512((void*)(out + x), _mm512_srli_epi32(v, 8));
+		}
+		return x;
+	}
+
+	SIMD_AVX512 static int moments_avx512(const int *row, int width, unsigned long long &sum, unsigned long long &sumsq) {
+		__m512i s = _mm512_setzero_si512(), q = _mm512_setzero_si512();
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m512i v = _mm512_loadu_si512((const void*)(row + x));
+			__m512i odd = _mm512_srli_epi64(v, 32);
+			s = _mm512_add_epi64(s, _mm512_add_epi64(_mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)), _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1))));
+			q = _mm512_add_epi64(q, _mm512_add_epi64(_mm512_mul_epu32(v, v), _mm512_mul_epu32(odd, odd)));
+		}
+		sum += (unsigned long long)_mm512_reduce_add_epi64(s);
+		sumsq += (unsigned long long)_mm512_reduce_add_epi64(q);
+		return x;
+	}
+
+	SIMD_AVX512 static int diff2_avx512(const int *a, const int *b, int width, unsigned long long &result) {
+		__m512i q = _mm512_setzero_si512();
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m512i d = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512((const void*)(a + x)), _mm512_loadu_si512((const void*)(b + x))));
+			__m512i odd = _mm512_srli_epi64(d, 32);
+			q = _mm512_add_epi64(q, _mm512_add_epi64(_mm512_mul_epu32(d, d), _mm512_mul_epu32(odd, odd)));
+		}
+		result += (unsigned long long)_mm512_reduce_add_epi64(q);
+		return x;
+	}
+
+	// sum of c log2(c) over the histogram, the entropy is log2(n) - sum / n
+	static double clogc_scalar(const unsigned int *c, size_t i, size_t bins) {
+		double result = 0.0;
+		for (; i < bins; i++)
+			if (c[i]) result += c[i] * std::log2((double)c[i]);
+		return result;
+	}
+
+	// log2 on 4 doubles: exponent from the bit pattern, mantissa m in [1, 2) through 2 atanh((m - 1) / (m + 1)) / ln 2
+	// the series up to t^13 leaves a relative error below 1e-8, far under the float result
+	SIMD_AVX2 static double clogc_avx2(const unsigned int *c, size_t bins, size_t &i) {
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256i mantissa = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFll);
+		const __m256i exponent_one = _mm256_set1_epi64x(0x3FF0000000000000ll);
+		const __m256d magic = _mm256_set1_pd(4503599627370496.0);			// 2^52, the exponent field lands in its mantissa
+		const __m256d bias = _mm256_set1_pd(4503599627370496.0 + 1023.0);
+		const __m256d inv_ln2 = _mm256_set1_pd(2.0 / 0.69314718055994530942);
+		__m256d acc = _mm256_setzero_pd();
+		for (i = 0; i + 4 <= bins; i += 4) {
+			__m256d x = _mm256_max_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(c + i))), one);	// empty bins count as 1 log2(1) = 0
+			__m256i bits = _mm256_castpd_si256(x);
+			__m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_castpd_si256(magic))), bias);
+			__m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantissa), exponent_one));
+			__m256d t = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+			__m256d t2 = _mm256_mul_pd(t, t);
+			__m256d s = _mm256_set1_pd(1.0 / 13.0);
+			s = _mm256_fmadd_pd(s, t2, _mm256_set1_pd(1.0 / 11.0));
+			s = _mm256_fmadd_pd(s, t2, _mm256_set1_pd(1.0 / 9.0));
+			s = _mm256_fmadd_pd(s, t2, _mm256_set1_pd(1.0 / 7.0));
+			s = _mm256_fmadd_pd(s, t2, _mm256_set1_pd(1.0 / 5.0));
+			s = _mm256_fmadd_pd(s, t2, _mm256_set1_pd(1.0 / 3.0));
+			s = _mm256_fmadd_pd(s, t2, one);
+			__m256d lg = _mm256_fmadd_pd(_mm256_mul_pd(s, t), inv_ln2, e);
+			acc = _mm256_fmadd_pd(x, lg, acc);
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+
+	static double entropy_kernel(const std::vector<unsigned int> &histogram, double pnum, bool vector) {
+		size_t i = 0;
+		double clogc = 0.0;
+		if (vector && simd::avx2() && !histogram.empty())
+			clogc = clogc_avx2(&histogram[0], histogram.size(), i);
+		if (!histogram.empty())
+			clogc += clogc_scalar(&histogram[0], i, histogram.size());
+		return std::log2(pnum) - clogc / pnum;
+	}
+
+	// Bayer 2x2 superpixel luma from two raw rows, q holds the Q9 weight of each quad position a b / c d
+	static void bayer_scalar(const unsigned short *r0, const unsigned short *r1, int x, int width, const int *q, int *out) {
+		for (; x < width; x++)
+			out[x] = (q[0] * r0[2 * x] + q[1] * r0[2 * x + 1] + q[2] * r1[2 * x] + q[3] * r1[2 * x + 1] + 256) >> 9;
+	}
+
+	// 8 superpixels per step, the even and odd raw pixels of a row are the low and high halves of every 32bit lane
+	SIMD_AVX2 static int bayer_avx2(const unsigned short *r0, const unsigned short *r1, int width, const int *q, int *out) {
+		const __m256i low = _mm256_set1_epi32(0xffff);
+		const __m256i qa = _mm256_set1_epi32(q[0]), qb = _mm256_set1_epi32(q[1]), qc = _mm256_set1_epi32(q[2]), qd = _mm256_set1_epi32(q[3]);
+		const __m256i round = _mm256_set1_epi32(256);
+		int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i v0 = _mm256_loadu_si256((const __m256i*)(r0 + 2 * x));
+			__m256i v1 = _mm256_loadu_si256((const __m256i*)(r1 + 2 * x));
+			__m256i s = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(v0, low), qa), _mm256_mullo_epi32(_mm256_srli_epi32(v0, 16), qb));
+			s = _mm256_add_epi32(s, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(v1, low), qc), _mm256_mullo_epi32(_mm256_srli_epi32(v1, 16), qd)));
+			_mm256_storeu_si256((__m256i*)(out + x), _mm256_srli_epi32(_mm256_add_epi32(s, round), 9));
+		}
+		return x;
+	}
+
+	// 3x3 neighborhood kernels of the center row b between a above and c below, interior pixels [x, width - 1)
+	static void sobel_scalar(const int *a, const int *b, const int *c, int x, int width, unsigned long long &gx2, unsigned long long &gy2) {
+		for (; x < width - 1; x++) {
+			long long gx = (a[x + 1] - a[x - 1]) + 2ll * (b[x + 1] - b[x - 1]) + (c[x + 1] - c[x - 1]);
+			long long gy = (c[x - 1] + 2ll * c[x] + c[x + 1]) - (a[x - 1] + 2ll * a[x] + a[x + 1]);
+			gx2 += (unsigned long long)(gx * gx);
+			gy2 += (unsigned long long)(gy * gy);
+		}
+	}
+
+	static void laplace_scalar(const int *a, const int *b, const int *c, int x, int width, unsigned long long &sum, unsigned long long &sumsq) {	// sum wraps, read it back signed
+		for (; x < width - 1; x++) {
+			long long l = a[x] + c[x] + b[x - 1] + b[x + 1] - 4ll * b[x];
+			sum += (unsigned long long)l;
+			sumsq += (unsigned long long)(l * l);
+		}
+	}
+
+	// one-level Haar transform of the 2x2 blocks [k, half) of rows r0 and r1, unnormalized since only energy ratios are used
+	static void haar_scalar(const int *r0, const int *r1, int k, int half, unsigned long long &detail, unsigned long long &approx) {
+		for (; k < half; k++) {
+			long long a = r0[2 * k], b = r0[2 * k + 1], c = r1[2 * k], d = r1[2 * k + 1];
+			long long ll = a + b + c + d, lh = a + b - c - d, hl = a - b + c - d, hh = a - b - c + d;
+			approx += (unsigned long long)(ll * ll);
+			detail += (unsigned long long)(lh * lh + hl * hl + hh * hh);
+		}
+	}
+
+	// AVX2 versions, 8 pixels or blocks per step, every term stays below 2^19 before squaring
+	SIMD_AVX2 static __m256i square_avx2(__m256i q, __m256i v) {	// accumulate the squares of 8 int32 into 4 uint64
+		v = _mm256_abs_epi32(v);
+		__m256i odd = _mm256_srli_epi64(v, 32);
+		return _mm256_add_epi64(q, _mm256_add_epi64(_mm256_mul_epu32(v, v), _mm256_mul_epu32(odd, odd)));
+	}
+
+	SIMD_AVX2 static int sobel_avx2(const int *a, const int *b, const int *c, int width, unsigned long long &gx2, unsigned long long &gy2) {
+		__m256i qx = _mm256_setzero_si256(), qy = _mm256_setzero_si256();
+		int x = 1;
+		for (; x + 9 <= width; x += 8) {
+			__m256i al = _mm256_loadu_si256((const __m256i*)(a + x - 1)), am = _mm256_loadu_si256((const __m256i*)(a + x)), ar = _mm256_loadu_si256((const __m256i*)(a + x + 1));
+			__m256i bl = _mm256_loadu_si256((const __m256i*)(b + x - 1)), br = _mm256_loadu_si256((const __m256i*)(b + x + 1));
+			__m256i cl = _mm256_loadu_si256((const __m256i*)(c + x - 1)), cm = _mm256_loadu_si256((const __m256i*)(c + x)), cr = _mm256_loadu_si256((const __m256i*)(c + x + 1));
+			__m256i gx = _mm256_add_epi32(_mm256_add_epi32(_mm256_sub_epi32(ar, al), _mm256_sub_epi32(cr, cl)), _mm256_slli_epi32(_mm256_sub_epi32(br, bl), 1));
+			__m256i gy = _mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(cl, cr), _mm256_slli_epi32(cm, 1)), _mm256_add_epi32(_mm256_add_epi32(al, ar), _mm256_slli_epi32(am, 1)));
+			qx = square_avx2(qx, gx);
+			qy = square_avx2(qy, gy);
+		}
+		gx2 += hsum_avx2(qx);
+		gy2 += hsum_avx2(qy);
+		return x;
+	}
+
+	SIMD_AVX2 static int laplace_avx2(const int *a, const int *b, const int *c, int width, unsigned long long &sum, unsigned long long &sumsq) {
+		__m256i s = _mm256_setzero_si256(), q = _mm256_setzero_si256();
+		int x = 1;
+		for (; x + 9 <= width; x += 8) {
+			__m256i bm = _mm256_loadu_si256((const __m256i*)(b + x));
+			__m256i l = _mm256_add_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + x)), _mm256_loadu_si256((const __m256i*)(c + x))),
+				_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(b + x - 1)), _mm256_loadu_si256((const __m256i*)(b + x + 1))));
+			l = _mm256_sub_epi32(l, _mm256_slli_epi32(bm, 2));
+			s = _mm256_add_epi64(s, _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(l)), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(l, 1))));
+			q = square_avx2(q, l);
+		}
+		sum += hsum_avx2(s);
+		sumsq += hsum_avx2(q);
+		return x;
+	}
+
+	// horizontal pair sums and differences come out of hadd / hsub in a shuffled block order, the same for both rows
+	SIMD_AVX2 static int haar_avx2(const int *r0, const int *r1, int half, unsigned long long &detail, unsigned long long &approx) {
+		__m256i qd = _mm256_setzero_si256(), qa = _mm256_setzero_si256();
+		int k = 0;
+		for (; k + 8 <= half; k += 8) {
+			__m256i u0 = _mm256_loadu_si256((const __m256i*)(r0 + 2 * k)), u1 = _mm256_loadu_si256((const __m256i*)(r0 + 2 * k + 8));
+			__m256i v0 = _mm256_loadu_si256((const __m256i*)(r1 + 2 * k)), v1 = _mm256_loadu_si256((const __m256i*)(r1 + 2 * k + 8));
+			__m256i s0 = _mm256_hadd_epi32(u0, u1), d0 = _mm256_hsub_epi32(u0, u1);	// a + b, a - b
+			__m256i s1 = _mm256_hadd_epi32(v0, v1), d1 = _mm256_hsub_epi32(v0, v1);	// c + d, c - d
+			qa = square_avx2(qa, _mm256_add_epi32(s0, s1));
+			qd = square_avx2(qd, _mm256_sub_epi32(s0, s1));
+			qd = square_avx2(qd, _mm256_add_epi32(d0, d1));
+			qd = square_avx2(qd, _mm256_sub_epi32(d0, d1));
+		}
+		detail += hsum_avx2(qd);
+		approx += hsum_avx2(qa);
+		return k;
+	}
+
+	// runtime dispatch: AVX-512, then AVX2, the scalar kernel finishes the row
+	template<typename T, luma L>
+	static void luma_kernel(const T *in, int width, int *out, bool vector) {
+		int x = 0;
+		if (vector && simd::avx512()) x = luma_avx512<T, L>(in, width, out);
+		else if (vector && simd::avx2()) x = luma_avx2<T, L>(in, width, out);
+		luma_scalar<T, L>(in, x, width, out);
+	}
+
+	static void moments_kernel(const int *row, int width, unsigned long long &sum, unsigned long long &sumsq, bool vector) {
+		int x = 0;
+		if (vector && simd::avx512()) x = moments_avx512(row, width, sum, sumsq);
+		else if (vector && simd::avx2()) x = moments_avx2(row, width, sum, sumsq);
+		moments_scalar(row, x, width, sum, sumsq);
+	}
+
+	static unsigned long long diff2_kernel(const int *a, const int *b, int width, bool vector) {
+		unsigned long long result = 0;
+		int x = 0;
+		if (vector && simd::avx512()) x = diff2_avx512(a, b, width, result);
+		else if (vector && simd::avx2()) x = diff2_avx2(a, b, width, result);
+		return result + diff2_scalar(a, b, x, width);
+	}
+
+	static void sobel_kernel(const int *a, const int *b, const int *c, int width, unsigned long long &gx2, unsigned long long &gy2, bool vector) {
+		int x = 1;
+		if (vector && simd::avx2()) x = sobel_avx2(a, b, c, width, gx2, gy2);
+		sobel_scalar(a, b, c, x, width, gx2, gy2);
+	}
+
+	static void laplace_kernel(const int *a, const int *b, const int *c, int width, unsigned long long &sum, unsigned long long &sumsq, bool vector) {
+		int x = 1;
+		if (vector && simd::avx2()) x = laplace_avx2(a, b, c, width, sum, sumsq);
+		laplace_scalar(a, b, c, x, width, sum, sumsq);
+	}
+
+	static void haar_kernel(const int *r0, const int *r1, int half, unsigned long long &detail, unsigned long long &approx, bool vector) {
+		int k = 0;
+		if (vector && simd::avx2()) k = haar_avx2(r0, r1, half, detail, approx);
+		haar_scalar(r0, r1, k, half, detail, approx);
+	}
+
+	// row kernels and reductions of the built-in metrics, the row kernel is a template argument of the band loop so it inlines
+	static constexpr int metric_back(int m) {	// rows above the current one a built-in metric reads
+		return m == BREN || m == TENG || m == LAPV ? 2 : (m == SPFQ || m == WAVR ? 1 : 0);
+	}
+
+	template<int M>
+	static void metric_row(const int *const *rows, int y, int width, partial &p, bool vector);
+
+	template<>
+	void metric_row<GLSD>(const int *const *rows, int y, int width, partial &p, bool vector) {	// graylevel standard deviation / graylevel variance
+		moments_kernel(rows[0], width, p.sum, p.sumsq, vector);
+	}
+
+	template<int dist>
+	static void diff_row(const int *const *rows, int y, int width, partial &p, bool vector) {	// first differences for spatial frequency, differences at distance two for Brenner
+		p.h += diff2_kernel(rows[0] + dist, rows[0], width - dist, vector);	// horizontal spatial gradient
+		if (y >= dist)
+			p.v += diff2_kernel(rows[0], rows[dist], width, vector);		// vertical spatial gradient, row-major
+	}
+
+	template<>
+	void metric_row<SPFQ>(const int *const *rows, int y, int width, partial &p, bool vector) {
+		diff_row<1>(rows, y, width, p, vector);
+	}
+
+	template<>
+	void metric_row<BREN>(const int *const *rows, int y, int width, partial &p, bool vector) {
+		diff_row<2>(rows, y, width, p, vector);
+	}
+
+	template<>
+	void metric_row<HISE>(const int *const *rows, int y, int width, partial &p, bool vector) {	// histogram entropy
+		size_t size = p.histogram.size();	// bins follow the data, a 12bit frame in a 16bit type fills 4096 of its 65536 bins
+		for (int x = 0; x < width; x++) {
+			size_t bin = (size_t)(rows[0][x] >> p.shift);
+			if (bin >= size) {	// grow by powers of two, at most the input range
+				size = std::max(size, (size_t)256);
+				while (size <= bin) size <<= 1;
+				size = std::min(size, std::max(bin + 1, (size_t)p.range >> p.shift));
+				p.histogram.resize(size, 0);
+			}
+			p.histogram[bin]++;
+		}
+	}
+
+	template<>
+	void metric_row<TENG>(const int *const *rows, int y, int width, partial &p, bool vector) {	// Sobel energy of the row above, borders skipped
+		if (y >= 2)
+			sobel_kernel(rows[2], rows[1], rows[0], width, p.h, p.v, vector);
+	}
+
+	template<>
+	void metric_row<LAPV>(const int *const *rows, int y, int width, partial &p, bool vector) {	// 4-neighbor Laplacian of the row above, borders skipped
+		if (y >= 2)
+			laplace_kernel(rows[2], rows[1], rows[0], width, p.sum, p.sumsq, vector);
+	}
+
+	template<>
+	void metric_row<WAVR>(const int *const *rows, int y, int width, partial &p, bool vector) {	// 2x2 blocks start on even rows, a band starting on an odd row carries the row above
+		if (y & 1)
+			haar_kernel(rows[1], rows[0], width / 2, p.h, p.v, vector);
+	}
+
+	static float glsd_finish(const partial &p, int width, int height, bool vector) {
+		double pnum = (double)width * height;
+		double mean = (double)p.sum / pnum;
+		return (float)std::sqrt(std::max(0.0, (double)p.sumsq / pnum - mean * mean));
+	}
+
+	static float spfq_finish(const partial &p, int width, int height, bool vector) {
+		double pnum = (double)width * height;
+		return (float)std::sqrt((double)p.h / pnum + (double)p.v / pnum);
+	}
+
+	static float bren_finish(const partial &p, int width, int height, bool vector) {
+		double pnum = (double)width * height;
+		return (float)std::sqrt(std::max((double)p.h / pnum, (double)p.v / pnum));
+	}
+
+	static float hise_finish(const partial &p, int width, int height, bool vector) {
+		return (float)entropy_kernel(p.histogram, (double)width * height, vector);
+	}
+
+	static float teng_finish(const partial &p, int width, int height, bool vector) {	// rms gradient magnitude
+		double pnum = (double)(width - 2) * (height - 2);
+		return pnum > 0.0 ? (float)std::sqrt(((double)p.h + (double)p.v) / pnum) : 0.0f;
+	}
+
+	static float lapv_finish(const partial &p, int width, int height, bool vector) {
+		double pnum = (double)(width - 2) * (height - 2);
+		if (pnum <= 0.0) return 0.0f;
+		double mean = (double)(long long)p.sum / pnum;
+		return (float)std::max(0.0, (double)p.sumsq / pnum - mean * mean);
+	}
+
+	static float wavr_finish(const partial &p, int width, int height, bool vector) {	// detail over approximation energy, grows with sharpness and ignores brightness
+		return p.v ? (float)((double)p.h / (double)p.v) : 0.0f;
+	}
+
+	static std::vector<metric> &registry() {	// built-in metrics first, their ids are the fmetric values
+		static std::vector<metric> metrics = {
+			{ "GLSD", metric_back(GLSD), metric_row<GLSD>, glsd_finish },
+			{ "SPFQ", metric_back(SPFQ), metric_row<SPFQ>, spfq_finish },
+			{ "BREN", metric_back(BREN), metric_row<BREN>, bren_finish },
+			{ "HISE", metric_back(HISE), metric_row<HISE>, hise_finish },
+			{ "TENG", metric_back(TENG), metric_row<TENG>, teng_finish },
+			{ "LAPV", metric_back(LAPV), metric_row<LAPV>, lapv_finish },
+			{ "WAVR", metric_back(WAVR), metric_row<WAVR>, wavr_finish },
+		};
+		return metrics;
+	}
+
+	int add_metric(const metric &m) {
+		registry().push_back(m);
+		return (int)registry().size();
+	}
+
+	const metric *find_metric(int id) {
+		std::vector<metric> &r = registry();
+		return id >= 1 && id <= (int)r.size() ? &r[id - 1] : 0;
+	}
+
+	int metric_id(const std::string &s) {
+		std::string name = s;
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = (char)std::toupper((unsigned char)name[i]);
+		std::vector<metric> &r = registry();
+		for (size_t i = 0; i < r.size(); i++)
+			if (r[i].name == name) return (int)i + 1;
+		if (name.empty() || name.find_first_not_of("0123456789") != std::string::npos) return 0;
+		int id = std::atoi(name.c_str());	// --fmeasure numbers still work
+		return find_metric(id) ? id : 0;
+	}
+
+	std::vector<std::string> metric_names() {
+		std::vector<std::string> names;
+		for (size_t i = 0; i < registry().size(); i++)
+			names.push_back(registry()[i].name);
+		return names;
+	}
+
 	template<typename T>
-	inline void rgb2gray(const T *in, T *out, int width, int height, int luma) {
-		//std::vector<unsigned char> R;	// R-channel
-		//std::vector<unsigned char> G;	// G-channel
-		//std::vector<unsigned char> B;	// B-channel
-		//for (int i = 0; i < num; i++) {
-		//	R.push_back(*(in + i * 3 + 0));
-		//	G.push_back(*(in + i * 3 + 1));
-		//	B.push_back(*(in + i * 3 + 2));
-		//}
-		//T *R = (T*)malloc(pnum * sizeof(T));	// R-channel
-		//T *G = (T*)malloc(pnum * sizeof(T));	// G-channel
-		//T *B = (T*)malloc(pnum * sizeof(T));	// B-channel
-		//for (int i = 0; i < pnum; i++) {	// split rgb channels
-		//	*(R + i) = *(in + i * 3 + 0);
-		//	*(G + i) = *(in + i * 3 + 1);
-		//	*(B + i) = *(in + i * 3 + 2);
-		//	out[i] = 0.2989*R[i] + 0.5870*G[i] + 0.1140*B[i];
-		//}
-		//// do whatever you want with individual channels
-		//delete[] R;	// free memory
-		//delete[] G;
-		//delete[] B;
-		int pnum = width * height;
-		for (int i = 0; i < pnum; i++) {
-			if (luma == 1)
-				out[i] = 0.2990 * in[i * 3 + 0] + 0.5870 * in[i * 3 + 1] + 0.1140 * in[i * 3 + 2];	// CCIR 601 luma criterio
-			else if (luma == 2)
-				out[i] = 0.2126 * in[i * 3 + 0] + 0.7152 * in[i * 3 + 1] + 0.0722 * in[i * 3 + 2];	// BT. 709 luma criterio
-			else if (luma == 3)
-				out[i] = 0.2120 * in[i * 3 + 0] + 0.7010 * in[i * 3 + 1] + 0.0870 * in[i * 3 + 2];	// SMPTE 240M luma criterio
-		}		
-	}
-
-	// focus measure #1 -- graylevel standard deviation / graylevel variance
+	void luma_row(const T *in, int width, luma l, int *out, bool vector) {
+		static constexpr void (*kernel[4])(const T*, int, int*, bool) = { luma_kernel<T, CCIR601>, luma_kernel<T, BT709>, luma_kernel<T, SMPTE240M>, luma_kernel<T, GREEN> };
+		kernel[l - 1](in, width, out, vector);
+	}
+
+	void bayer_row(const unsigned short *in, int width, int y, color::cfa phase, luma l, int *out, bool vector) {
+		const int *w = luma_weights[l - 1];
+		int q[4];	// weights of the quad positions: red and blue count twice, each green once
+		switch (phase) {
+		case color::CFA_RED:				q[0] = 2 * w[0]; q[1] = w[1]; q[2] = w[1]; q[3] = 2 * w[2]; break;
+		case color::CFA_BLUE:				q[0] = 2 * w[2]; q[1] = w[1]; q[2] = w[1]; q[3] = 2 * w[0]; break;
+		case color::CFA_GREEN_LEFT_OF_RED:	q[0] = w[1]; q[1] = 2 * w[0]; q[2] = 2 * w[2]; q[3] = w[1]; break;
+		default:							q[0] = w[1]; q[1] = 2 * w[2]; q[2] = 2 * w[0]; q[3] = w[1]; break;	// green left of blue
+		}
+		const unsigned short *r0 = in + (size_t)(2 * y) * width;
+		const unsigned short *r1 = r0 + width;
+		int half = width / 2;
+		int x = 0;
+		if (vector && simd::avx2())
+			x = bayer_avx2(r0, r1, half, q, out);
+		bayer_scalar(r0, r1, x, half, q, out);
+	}
+
 	template<typename T>
-	float glsd(const T *in, int width, int height) {
-		float result = 0.0f;
-		int pnum = width * height;
-		int sum = 0;
-		for (int i = 0; i < pnum; i++)
-			sum += in[i];
-		float mean = (float)sum / pnum;
-		for (int i = 0; i < pnum; i++)
-			result += std::pow((in[i] - mean), 2);
-		result = std::sqrt(result / pnum);
+	void rgb2gray(const T *in, T *out, int width, int height, luma l) {
+		std::vector<int> &row = scratch(width);
+		for (int y = 0; y < height; y++) {
+			luma_row(in + (size_t)y * width * 3, width, l, &row[0], true);
+			for (int x = 0; x < width; x++)
+				out[(size_t)y * width + x] = (T)row[x];
+		}
+	}
 
-		return result;
+	// accumulate luma rows [y0, y1) of width pixels, produce(y, out) converts row y from whatever the source is and kernel(window, y) folds it in
+	template<typename F, typename K>
+	static void accumulate_rows(int width, int y0, int y1, int range, int back, partial &p, F produce, K kernel) {
+		p.range = range;
+		std::vector<int> &rows = scratch((size_t)width * 3);	// rolling window of three luma rows
+		const int *window[3] = { 0, 0, 0 };
+		for (int y = std::max(0, y0 - back); y < y1; y++) {
+			int *cur = &rows[(size_t)(y % 3) * width];
+			produce(y, cur);
+			if (y < y0) continue;	// carry row of the band above
+			p.n += width;
+			for (int k = 0; k <= back && k <= y; k++)
+				window[k] = &rows[(size_t)((y - k) % 3) * width];
+			kernel(window, y);
+		}
+	}
+
+	// block partials of one band, luma pixel (x, y) falls into block (x * cols / width, y * rows / height)
+	struct block_grid {
+		int cols;				// blocks across
+		int rows;				// blocks down
+		int width;				// luma frame size
+		int height;
+		std::vector<partial> b;	// row-major
+	};
+
+	static int block_start(int i, int n, int size) {	// first pixel of block i when size pixels are split into n blocks
+		return (int)(((long long)i * size + n - 1) / n);
 	}
 
-	// focus measure #2 -- spatial frequency
+	// run kernel(segment, width, partial) on the part of luma row y inside every block, the window rows are offset to the block
+	// horizontal neighbors across a block edge are skipped, the global value still sees the whole row
+	template<typename K>
+	static void split(block_grid *g, const int *const *rows, int y, int back, K kernel) {
+		if (!g) return;
+		partial *b = &g->b[(size_t)((long long)y * g->rows / g->height) * g->cols];
+		const int *segment[3] = { 0, 0, 0 };
+		for (int i = 0; i < g->cols; i++) {
+			int x0 = block_start(i, g->cols, g->width);
+			for (int k = 0; k <= back && k <= y; k++)
+				segment[k] = rows[k] + x0;
+			kernel(segment, block_start(i + 1, g->cols, g->width) - x0, b[i]);
+		}
+	}
+
+	// built-in metrics get their own band loop, metrics added at run time go through the registry
+	template<int M, typename F>
+	static void accumulate_builtin(int width, int y0, int y1, int range, partial &p, block_grid *g, bool vector, F produce) {
+		accumulate_rows(width, y0, y1, range, metric_back(M), p, produce, [&](const int *const *rows, int y) {
+			metric_row<M>(rows, y, width, p, vector);
+			split(g, rows, y, metric_back(M), [&](const int *const *segment, int w, partial &b) {
+				metric_row<M>(segment, y, w, b, vector);
+			});
+		});
+	}
+
+	template<typename F>
+	static void accumulate_metric(int width, int y0, int y1, int range, fmetric alg, partial &p, block_grid *g, bool vector, F produce) {
+		switch (alg) {	// choose focus measure algorithm to evaluate in-focus/out-of-focus, once per band
+		case GLSD: accumulate_builtin<GLSD>(width, y0, y1, range, p, g, vector, produce); break;
+		case SPFQ: accumulate_builtin<SPFQ>(width, y0, y1, range, p, g, vector, produce); break;
+		case BREN: accumulate_builtin<BREN>(width, y0, y1, range, p, g, vector, produce); break;
+		case HISE: accumulate_builtin<HISE>(width, y0, y1, range, p, g, vector, produce); break;
+		case TENG: accumulate_builtin<TENG>(width, y0, y1, range, p, g, vector, produce); break;
+		case LAPV: accumulate_builtin<LAPV>(width, y0, y1, range, p, g, vector, produce); break;
+		case WAVR: accumulate_builtin<WAVR>(width, y0, y1, range, p, g, vector, produce); break;
+		default: {
+			const metric *m = find_metric(alg);
+			if (!m) return;
+			accumulate_rows(width, y0, y1, range, m->back, p, produce, [&](const int *const *rows, int y) {
+				m->row(rows, y, width, p, vector);
+				split(g, rows, y, m->back, [&](const int *const *segment, int w, partial &b) {
+					m->row(segment, y, w, b, vector);
+				});
+			});
+		}
+		}
+	}
+
+	// band of an interleaved rgb frame with pixel type, luma standard and metric fixed at compile time
+	template<typename T, luma L, int M>
+	static void rgb_band(const T *in, int width, int y0, int y1, partial &p, block_grid *g, bool vector) {
+		accumulate_builtin<M>(width, y0, y1, sizeof(T) == 1 ? 256 : 65536, p, g, vector, [&](int y, int *out) {
+			luma_kernel<T, L>(in + (size_t)y * width * 3, width, out, vector);
+		});
+	}
+
+	// generic band for metrics added at run time
 	template<typename T>
-	float spfq(const T *in, int width, int height) {
-		float result = 0.0f;
-		int pnum = width * height;
-		int hsum = 0; int vsum = 0;
-		for (int i = 0; i < height; i++)
-			for (int j = 1; j < width; j++)
-				hsum += (int)std::pow((in[i * width + j] - in[i * width + (j - 1)]), 2);	// horizontal spatial gradient
-		for (int i = 0; i < width; i++)
-			for (int j = 1; j < height; j++)
-				vsum += (int)std::pow((in[j * width + i] - in[(j - 1) * width + i]), 2);	// vertical spatial gradient
-		float hmean = (float)hsum / pnum;
-		float vmean = (float)vsum / pnum;
-		result = std::sqrt(hmean + vmean);
+	static void rgb_band_any(const T *in, int width, int y0, int y1, luma l, fmetric alg, partial &p, block_grid *g, bool vector) {
+		accumulate_metric(width, y0, y1, sizeof(T) == 1 ? 256 : 65536, alg, p, g, vector, [&](int y, int *out) {
+			luma_row(in + (size_t)y * width * 3, width, l, out, vector);
+		});
+	}
 
-		return result;
+	template<typename T>
+	using band_kernel = void (*)(const T*, int, int, int, partial&, block_grid*, bool);
+
+	#define FM_BANDS(T, L) { rgb_band<T, L, GLSD>, rgb_band<T, L, SPFQ>, rgb_band<T, L, BREN>, rgb_band<T, L, HISE>, rgb_band<T, L, TENG>, rgb_band<T, L, LAPV>, rgb_band<T, L, WAVR> }
+
+	template<typename T>
+	static band_kernel<T> rgb_kernel(luma l, fmetric alg) {	// every luma x metric pair of one pixel type, 0 for metrics outside the table
+		static constexpr band_kernel<T> table[4][WAVR] = { FM_BANDS(T, CCIR601), FM_BANDS(T, BT709), FM_BANDS(T, SMPTE240M), FM_BANDS(T, GREEN) };
+		return alg >= GLSD && alg <= WAVR && l >= CCIR601 && l <= GREEN ? table[l - 1][alg - 1] : 0;
 	}
 
-	// focus measure #3 -- Brenner's first differentiation
+	#undef FM_BANDS
+
 	template<typename T>
-	float bren(const T *in, int width, int height) {
-		float result = 0.0f;
-		int pnum = width * height;
-		int hsum = 0; int vsum = 0;
-		for (int i = 0; i < height; i++)
-			for (int j = 2; j < width; j++)
-				hsum += (int)std::pow((in[i * width + j] - in[i * width + (j - 2)]), 2);	// horizontal first derivative
-		for (int i = 0; i < width; i++)
-			for (int j = 2; j < height; j++)
-				vsum += (int)std::pow((in[j * width + i] - in[(j - 2) * width + i]), 2);	// vertical first derivative
-		float hmean = (float)hsum / pnum;
-		float vmean = (float)vsum / pnum;
-		result = std::max(hmean, vmean);
-		result = std::sqrt(result);
+	static void rgb_accumulate(band_kernel<T> kernel, const T *in, int width, int y0, int y1, fmetric alg, luma l, partial &p, block_grid *g, bool vector) {
+		if (kernel)
+			kernel(in, width, y0, y1, p, g, vector);
+		else
+			rgb_band_any(in, width, y0, y1, l, alg, p, g, vector);
+	}
 
-		return result;
+	static void raw_accumulate(const unsigned short *in, int width, int y0, int y1, color::cfa phase, fmetric alg, luma l, partial &p, block_grid *g, bool vector) {
+		accumulate_metric(width / 2, y0, y1, 65536, alg, p, g, vector, [&](int y, int *out) {
+			bayer_row(in, width, y, phase, l, out, vector);
+		});
+	}
+
+	static void gray_accumulate(const unsigned short *in, int width, int y0, int y1, fmetric alg, partial &p, block_grid *g, bool vector) {
+		accumulate_metric(width, y0, y1, 65536, alg, p, g, vector, [&](int y, int *out) {
+			const unsigned short *row = in + (size_t)y * width;
+			for (int x = 0; x < width; x++)	// widening only, the compiler vectorizes it
+				out[x] = row[x];
+		});
+	}
+
+	template<typename T>
+	void accumulate(const T *in, int width, int height, int y0, int y1, fmetric alg, luma l, partial &p, bool vector) {
+		rgb_accumulate(rgb_kernel<T>(l, alg), in, width, y0, y1, alg, l, p, 0, vector);
+	}
+
+	void accumulate_raw(const unsigned short *in, int width, int height, int y0, int y1, color::cfa phase, fmetric alg, luma l, partial &p, bool vector) {
+		raw_accumulate(in, width, y0, y1, phase, alg, l, p, 0, vector);
+	}
+
+	void accumulate_gray(const unsigned short *in, int width, int height, int y0, int y1, fmetric alg, partial &p, bool vector) {
+		gray_accumulate(in, width, y0, y1, alg, p, 0, vector);
+	}
+
+	float finish(const partial &p, fmetric alg, int width, int height, bool vector) {
+		const metric *m = find_metric(alg);
+		return m ? m->finish(p, width, height, vector) : 0.0f;
+	}
+
+	// run acc(y0, y1, partial, grid) over row bands of a width x height luma frame on the pool, merge the partial sums in band order
+	// and finish the global value plus, with a map, the value of every block
+	template<typename F>
+	static float bands(int width, int height, fmetric alg, int range, int bin_shift, focus_map *map, stim::threadpool *pool, bool vector, F acc) {
+		if (!pool) pool = &stim::shared_pool();
+		int n = std::min(height, pool->size() * 4);	// a few bands per thread evens out the load, a band re-reads at most two carry rows
+		if (alg == HISE) n = std::min(n, pool->size());	// every band fills and merges its own histogram
+		int block_shift = bin_shift;	// block histograms keep at most 256 bins
+		while ((range >> block_shift) > 256) block_shift++;
+		std::vector<partial> band(n);
+		std::vector<block_grid> grid(map ? n : 0);
+		pool->run(n, [&](int b) {
+			band[b].shift = bin_shift;
+			block_grid *g = 0;
+			if (map) {
+				g = &grid[b];
+				g->cols = map->cols; g->rows = map->rows;
+				g->width = width; g->height = height;
+				g->b.resize((size_t)map->cols * map->rows);
+				for (size_t k = 0; k < g->b.size(); k++) {
+					g->b[k].shift = block_shift;
+					g->b[k].range = range;
+				}
+			}
+			acc((int)((long long)b * height / n), (int)((long long)(b + 1) * height / n), band[b], g);
+		});
+		partial p;
+		p.shift = bin_shift;
+		for (int b = 0; b < n; b++)	// fixed merge order, integer sums make the result independent of the thread count
+			p.add(band[b]);
+
+		if (map) {
+			map->values.assign((size_t)map->cols * map->rows, 0.0f);
+			for (int j = 0; j < map->rows; j++)
+				for (int i = 0; i < map->cols; i++) {
+					size_t k = (size_t)j * map->cols + i;
+					partial q;
+					q.shift = block_shift;
+					for (int b = 0; b < n; b++)
+						q.add(grid[b].b[k]);
+					int bw = block_start(i + 1, map->cols, width) - block_start(i, map->cols, width);
+					int bh = block_start(j + 1, map->rows, height) - block_start(j, map->rows, height);
+					map->values[k] = bw > 0 && bh > 0 ? finish(q, alg, bw, bh, vector) : 0.0f;
+				}
+		}
+
+		return finish(p, alg, width, height, vector);
+	}
+
+	static focus_map *checked(focus_map &map, int width, int height) {	// a grid finer than the frame has empty blocks, clamp it
+		map.cols = std::max(1, std::min(map.cols, width));
+		map.rows = std::max(1, std::min(map.rows, height));
+		return &map;
+	}
+
+	template<typename T>
+	float eval_fm(const T *in, int width, int height, fmetric alg, luma l, int bin_shift, stim::threadpool *pool, bool vector) {
+		band_kernel<T> kernel = rgb_kernel<T>(l, alg);	// dispatched once per call, the bands run a loop without metric or luma branches
+		return bands(width, height, alg, sizeof(T) == 1 ? 256 : 65536, bin_shift, 0, pool, vector, [&](int y0, int y1, partial &b, block_grid *g) {
+			rgb_accumulate(kernel, in, width, y0, y1, alg, l, b, g, vector);
+		});
+	}
+
+	template<typename T>
+	float eval_fm(const T *in, int width, int height, fmetric alg, focus_map &map, luma l, int bin_shift, stim::threadpool *pool, bool vector) {
+		band_kernel<T> kernel = rgb_kernel<T>(l, alg);
+		return bands(width, height, alg, sizeof(T) == 1 ? 256 : 65536, bin_shift, checked(map, width, height), pool, vector, [&](int y0, int y1, partial &b, block_grid *g) {
+			rgb_accumulate(kernel, in, width, y0, y1, alg, l, b, g, vector);
+		});
+	}
+
+	float eval_raw(const unsigned short *in, int width, int height, color::cfa phase, fmetric alg, luma l, int bin_shift, stim::threadpool *pool, bool vector) {
+		return bands(width / 2, height / 2, alg, 65536, bin_shift, 0, pool, vector, [&](int y0, int y1, partial &b, block_grid *g) {
+			raw_accumulate(in, width, y0, y1, phase, alg, l, b, g, vector);
+		});
+	}
+
+	float eval_raw(const unsigned short *in, int width, int height, color::cfa phase, fmetric alg, focus_map &map, luma l, int bin_shift, stim::threadpool *pool, bool vector) {
+		return bands(width / 2, height / 2, alg, 65536, bin_shift, checked(map, width / 2, height / 2), pool, vector, [&](int y0, int y1, partial &b, block_grid *g) {
+			raw_accumulate(in, width, y0, y1, phase, alg, l, b, g, vector);
+		});
+	}
+
+	float eval_gray(const unsigned short *in, int width, int height, fmetric alg, int bin_shift, stim::threadpool *pool, bool vector) {
+		return bands(width, height, alg, 65536, bin_shift, 0, pool, vector, [&](int y0, int y1, partial &b, block_grid *g) {
+			gray_accumulate(in, width, y0, y1, alg, b, g, vector);
+		});
 	}
 
-	// focus measure #4 -- histogram entropy
 	template<typename T>
-	float hise(const T *in, int width, int height) {
-		float result = 0.0f;
-		int pnum = width * height;
-		std::vector<int> value;
-		std::vector<float> count;
-		for (int i = 0; i < pnum; i++) {
-			auto iter = std::find(value.begin(), value.end(), in[i]);
-			if (iter == value.end()) {
-				value.push_back(in[i]);
-				count.push_back(1.0f);
+	accumulator<T>::accumulator(const T *in, int w, int h, fmetric a, luma lw, int bin_shift, bool v) {
+		frame = in;
+		width = w; height = h;
+		alg = a; l = lw; vector = v;
+		const metric *m = find_metric(alg);
+		back = m ? m->back : 0;
+		total.shift = bin_shift;
+		pushed.assign(h, 0);
+		rows = 0;
+		outstanding = 0;
+	}
+
+	template<typename T>
+	void accumulator<T>::merge(int y0, int y1) {	// outside the lock, strips are measured concurrently
+		stim::threadpool &pool = stim::shared_pool();
+		int n = std::max(1, std::min((y1 - y0) / 64, pool.size() * 4));	// a whole frame in one strip, as the sdk color path pushes it, still runs banded
+		if (alg == HISE) n = std::min(n, pool.size());
+		std::vector<partial> band(n);
+		pool.run(n, [&](int b) {	// a strip pushed from a pool worker runs its bands inline
+			band[b].shift = total.shift;
+			accumulate(frame, width, height, y0 + (int)((long long)b * (y1 - y0) / n), y0 + (int)((long long)(b + 1) * (y1 - y0) / n), alg, l, band[b], vector);
+		});
+		std::lock_guard<std::mutex> guard(lock);
+		for (int b = 0; b < n; b++)
+			total.add(band[b]);
+	}
+
+	template<typename T>
+	void accumulator<T>::push(int y0, int y1) {
+		y0 = std::max(0, y0); y1 = std::min(height, y1);
+		if (y0 >= y1) return;
+		int inner = y0 > 0 ? std::min(y1, y0 + back) : y0;	// rows from here on read only rows of this strip
+		if (inner < y1) merge(inner, y1);
+
+		std::vector<std::pair<int, int> > due;	// seams whose rows above are all final now
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::fill(pushed.begin() + y0, pushed.begin() + y1, 1);
+			rows += y1 - y0;
+			if (inner > y0) {
+				seams.push_back(std::make_pair(y0, inner));
+				outstanding++;
 			}
-			else {
-				int index = (int)std::distance(value.begin(), iter);
-				count[index]++;
+			for (size_t k = 0; k < seams.size();) {
+				int a = std::max(0, seams[k].first - back), b = seams[k].second;
+				if (std::find(pushed.begin() + a, pushed.begin() + b, 0) == pushed.begin() + b) {
+					due.push_back(seams[k]);
+					seams[k] = seams.back();
+					seams.pop_back();
+				}
+				else k++;
 			}
 		}
-		for (size_t i = 0; i < count.size(); i++) {
-			count[i] = count[i] / pnum;
-			result += -count[i] * std::log2f(count[i]);
+		for (size_t k = 0; k < due.size(); k++) {
+			merge(due[k].first, due[k].second);
+			std::lock_guard<std::mutex> guard(lock);
+			outstanding--;
 		}
+	}
 
-		return result;
+	template<typename T>
+	bool accumulator<T>::complete() {
+		std::lock_guard<std::mutex> guard(lock);
+		return rows == height && outstanding == 0;
 	}
-	
-	// compute global focus measure
+
 	template<typename T>
-	float eval_fm(const T *in, int width, int height, fmetric alg) {
-		float result = 0.0f;
-		T *gimg = (T*)malloc(width * height * sizeof(T));
-		rgb2gray<T>(in, gimg, width, height);
-		switch (alg) {	// choose focus measure algorithm to evaluate in-focus/out-of-focus
-		case GLSD:
-			result = glsd<T>(gimg, width, height);
-			break;
-		case SPFQ:
-			result = spfq<T>(gimg, width, height);
-			break;
-		case BREN:
-			result = bren<T>(gimg, width, height);
-			break;
-		case HISE:
-			result = hise<T>(gimg, width, height);
-			break;
-		}
-		
-		return result;	
+	float accumulator<T>::value() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (rows == height && outstanding == 0)
+				return finish(total, alg, width, height, vector);
+		}
+		std::cout << "focus measure of an incomplete frame, measuring it whole" << std::endl;
+		return eval_fm(frame, width, height, alg, l, total.shift, 0, vector);
 	}
 }
 
 // do all forward declaration for all template function to avoid LINK errors
-template void fm::rgb2gray<unsigned char>(const unsigned char *in, unsigned char *out, int width, int height);
-template void fm::rgb2gray<unsigned short>(const unsigned short *in, unsigned short *out, int width, int height);
-template float fm::glsd<unsigned char>(const unsigned char *in, int width, int height);
-template float fm::glsd<unsigned short>(const unsigned short *in, int width, int height);
-template float fm::spfq<unsigned char>(const unsigned char *in, int width, int height);
-template float fm::spfq<unsigned short>(const unsigned short *in, int width, int height);
-template float fm::bren<unsigned char>(const unsigned char *in, int width, int height);
-template float fm::bren<unsigned short>(const unsigned short *in, int width, int height);
-template float fm::hise<unsigned char>(const unsigned char *in, int width, int height);
-template float fm::hise<unsigned short>(const unsigned short *in, int width, int height);
-template float fm::eval_fm<unsigned char>(const unsigned char *in, int width, int height, fmetric alg);
-template float fm::eval_fm<unsigned short>(const unsigned short *in, int width, int height, fmetric alg);
\ No newline at end of file
+template void fm::luma_row<unsigned char>(const unsigned char *in, int width, luma l, int *out, bool vector);
+template void fm::luma_row<unsigned short>(const unsigned short *in, int width, luma l, int *out, bool vector);
+template void fm::rgb2gray<unsigned char>(const unsigned char *in, unsigned char *out, int width, int height, luma l);
+template void fm::rgb2gray<unsigned short>(const unsigned short *in, unsigned short *out, int width, int height, luma l);
+template void fm::accumulate<unsigned char>(const unsigned char *in, int width, int height, int y0, int y1, fmetric alg, luma l, partial &p, bool vector);
+template void fm::accumulate<unsigned short>(const unsigned short *in, int width, int height, int y0, int y1, fmetric alg, luma l, partial &p, bool vector);
+template float fm::eval_fm<unsigned char>(const unsigned char *in, int width, int height, fmetric alg, luma l, int bin_shift, stim::threadpool *pool, bool vector);
+template float fm::eval_fm<unsigned short>(const unsigned short *in, int width, int height, fmetric alg, luma l, int bin_shift, stim::threadpool *pool, bool vector);
+template float fm::eval_fm<unsigned char>(const unsigned char *in, int width, int height, fmetric alg, focus_map &map, luma l, int bin_shift, stim::threadpool *pool, bool vector);
+template float fm::eval_fm<unsigned short>(const unsigned short *in, int width, int height, fmetric alg, focus_map &map, luma l, int bin_shift, stim::threadpool *pool, bool vector);
+template class fm::accumulator<unsigned char>;
+template class fm::accumulator<unsigned short>;
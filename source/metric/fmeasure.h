@@ -3,6 +3,18 @@
 // 2. spatial frequency
 // 3. Brenner's first differentiation
 // 4. histogram entropy
+// 5. Tenengrad, Sobel gradient energy
+// 6. variance of Laplacian
+// 7. Haar wavelet ratio, detail over approximation energy of a one-level transform
+// metrics live in a registry by name, each brings a row kernel and a reduction, new ones are added with add_metric()
+// the rgb to luma conversion is fused into the metric: every row is converted once into a small per-thread scratch and consumed right away,
+// no full-frame grayscale buffer is allocated and the frame is read exactly once
+// a coarse block focus map comes out of the same pass: the part of every luma row inside a block also feeds that block's partial sums
+// row kernels have AVX2 and AVX-512 versions selected at run time, vector = false runs the scalar reference
+// the frame is split into row bands on the persistent thread pool, partial sums are merged in band order so the result never depends on scheduling
+// a frame that is still being written strip by strip can be measured incrementally, the value is ready right after the last strip
+// raw Bayer frames are measured on 2x2 superpixel luma (or green only), half resolution without demosaic or color processing
+// binned readouts already mix the Bayer channels on the sensor and are measured as they are
 
 #pragma once
 
@@ -10,28 +22,123 @@
 #define FMEASURE_H
 
 #include <vector>
+#include <string>
 #include <algorithm>
+#include <mutex>
+#include "../threadpool.h"
+#include "../color/demosaic.h"
 
 namespace fm {
-	enum fmetric;
+	enum fmetric {GLSD = 1, SPFQ, BREN, HISE, TENG, LAPV, WAVR};	// built-in metrics in registration order, same numbering as --fmeasure
+	enum luma {CCIR601 = 1, BT709, SMPTE240M, GREEN};	// luma weights, fixed point with 8 fractional bits, GREEN keeps the green channel only
 
+	// partial sums over a band of rows, bands can be merged in any grouping
+	struct partial {
+		unsigned long long n;		// pixels
+		unsigned long long sum;		// luma sum
+		unsigned long long sumsq;	// squared luma sum
+		unsigned long long h;		// squared horizontal differences
+		unsigned long long v;		// squared vertical differences
+		int shift;							// luma bits dropped per histogram bin
+		int range;							// luma values, 256 or 65536
+		std::vector<unsigned int> histogram;	// direct-indexed luma histogram, grown to the largest luma seen
+
+		partial() { n = 0; sum = 0; sumsq = 0; h = 0; v = 0; shift = 0; range = 0; }
+		void add(const partial &p);	// merge another band
+	};
+
+	// coarse grid of block focus values computed in the same pass as the global value
+	struct focus_map {
+		int cols;					// blocks across
+		int rows;					// blocks down
+		std::vector<float> values;	// row-major, luma pixel (x, y) falls into block (x * cols / width, y * rows / height)
+
+		focus_map(int c = 0, int r = 0) { cols = c; rows = r; }
+	};
+
+	// a registered focus metric, the row kernel folds luma rows into partial sums and the reduction turns the merged sums into the measure
+	struct metric {
+		std::string name;	// selects the metric in --fmeasure
+		int back;			// rows above the current one the row kernel reads, at most 2
+		void (*row)(const int *const *rows, int y, int width, partial &p, bool vector);	// rows[k] is luma row y - k, valid for k <= min(back, y)
+		float (*finish)(const partial &p, int width, int height, bool vector);
+	};
+
+	int add_metric(const metric &m);		// register a metric before the first evaluation, returns its id
+	const metric *find_metric(int id);		// 0 when unknown
+	int metric_id(const std::string &s);	// id of a registered name or number, 0 when unknown
+	std::vector<std::string> metric_names();	// in id order
+
+	// convert a row of interleaved rgb into integer luma
 	template<typename T>
-	inline void rgb2gray(const T *in, T *out, int width, int height, int luma = 1);
+	void luma_row(const T *in, int width, luma l, int *out, bool vector = true);
 
+	// convert superpixel row y (raw rows 2y and 2y + 1) of a Bayer frame into width / 2 luma values
+	void bayer_row(const unsigned short *in, int width, int y, color::cfa phase, luma l, int *out, bool vector = true);
+
+	// convert from rgb to grayscale into a caller-owned buffer
 	template<typename T>
-	float glsd(const T *in, int width, int height);
+	void rgb2gray(const T *in, T *out, int width, int height, luma l = CCIR601);
 
+	// accumulate rows [y0, y1), vertical differences reach back into the rows above y0
 	template<typename T>
-	float spfq(const T *in, int width, int height);
+	void accumulate(const T *in, int width, int height, int y0, int y1, fmetric alg, luma l, partial &p, bool vector = true);
+
+	// accumulate superpixel rows [y0, y1) of a raw Bayer frame of width x height pixels
+	void accumulate_raw(const unsigned short *in, int width, int height, int y0, int y1, color::cfa phase, fmetric alg, luma l, partial &p, bool vector = true);
 
+	// accumulate rows [y0, y1) of a single channel frame
+	void accumulate_gray(const unsigned short *in, int width, int height, int y0, int y1, fmetric alg, partial &p, bool vector = true);
+
+	// turn the partial sums of a whole frame into the focus measure
+	float finish(const partial &p, fmetric alg, int width, int height, bool vector = true);
+
+	// compute global focus measure
 	template<typename T>
-	float bren(const T *in, int width, int height);
+	float eval_fm(const T *in, int width, int height, fmetric alg, luma l = CCIR601, int bin_shift = 0, stim::threadpool *pool = 0, bool vector = true);	// HISE bins cover the luma present, at most 256 or 65536 >> bin_shift
 
+	// compute global focus measure and the block map of map.cols x map.rows blocks, block histograms keep at most 256 bins
 	template<typename T>
-	float hise(const T *in, int width, int height);
+	float eval_fm(const T *in, int width, int height, fmetric alg, focus_map &map, luma l = CCIR601, int bin_shift = 0, stim::threadpool *pool = 0, bool vector = true);
+
+	// compute global focus measure of a raw Bayer frame
+	float eval_raw(const unsigned short *in, int width, int height, color::cfa phase, fmetric alg, luma l = CCIR601, int bin_shift = 0, stim::threadpool *pool = 0, bool vector = true);
+
+	// compute global focus measure and the block map of a raw Bayer frame, blocks split the superpixel frame
+	float eval_raw(const unsigned short *in, int width, int height, color::cfa phase, fmetric alg, focus_map &map, luma l = CCIR601, int bin_shift = 0, stim::threadpool *pool = 0, bool vector = true);
 
+	// compute global focus measure of a single channel frame
+	float eval_gray(const unsigned short *in, int width, int height, fmetric alg, int bin_shift = 0, stim::threadpool *pool = 0, bool vector = true);
+
+	// incremental focus measure of an interleaved rgb frame that arrives in row strips, e.g. from color::processor
+	// a strip is measured as soon as it is pushed, only its first rows, whose kernels read across the strip edge, wait for the rows above
+	// strips come in any order and from any thread, the sums are integers so the value equals eval_fm() on the finished frame
 	template<typename T>
-	float eval_fm(const T *in, int width, int height, fmetric alg);
+	class accumulator {
+	private:
+		const T *frame;
+		int width;
+		int height;
+		fmetric alg;
+		luma l;
+		bool vector;
+		int back;						// carry rows the metric reads above a row
+		std::mutex lock;				// strips are pushed from the pool threads
+		partial total;					// merged sums of every measured row
+		std::vector<char> pushed;		// rows already final in the frame
+		std::vector<std::pair<int, int> > seams;	// strip edge rows [y0, y1) still waiting for the rows above
+		int rows;						// rows pushed so far
+		int outstanding;				// seams not merged yet
+
+		void merge(int y0, int y1);		// measure rows [y0, y1) and fold them into the total
+
+	public:
+		accumulator(const T *in, int width, int height, fmetric alg, luma l = CCIR601, int bin_shift = 0, bool vector = true);
+
+		void push(int y0, int y1);		// rows [y0, y1) of the frame are final, every row is pushed once
+		bool complete();				// every row is measured
+		float value();					// focus measure, a full pass over the frame when incomplete
+	};
 }
 
-#endif
\ No newline at end of file
+#endif
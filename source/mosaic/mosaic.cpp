@@ -0,0 +1,231 @@
+#include "mosaic.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace stim {
+	static const int T = mosaic::tile_size;
+	static const size_t tile_bytes = (size_t)T * T * 3;
+
+	// little endian BigTIFF field types and tags
+	enum { TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_RATIONAL = 5, TIFF_LONG8 = 16 };
+
+	struct ifd_entry {
+		unsigned short tag;
+		unsigned short type;
+		unsigned long long count;
+		unsigned long long value;	// inline value or offset of the out-of-line array
+	};
+
+	static void append(std::vector<unsigned char> &out, const void *p, size_t n) {
+		out.insert(out.end(), (const unsigned char*)p, (const unsigned char*)p + n);
+	}
+
+	mosaic::mosaic() {
+		end = 0;
+		frame_width = 0; frame_height = 0;
+		step_x = 0; step_y = 0;
+		cols = 0; rows = 0;
+		psize = 0.0f;
+	}
+
+	mosaic::~mosaic() {
+		close();
+	}
+
+	int mosaic::create(std::string filename, int fw, int fh, int c, int r, int sx, int sy, float ps) {
+		frame_width = fw; frame_height = fh;
+		cols = c; rows = r;
+		step_x = sx; step_y = sy;
+		psize = ps;
+
+		file.open(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file) { std::cout << "failed to create " << filename << std::endl; return 1; }
+		unsigned char header[16] = { 'I', 'I', 43, 0, 8, 0, 0, 0 };	// BigTIFF, first directory offset patched at close
+		file.write((const char*)header, sizeof(header));
+		end = sizeof(header);
+
+		levels.clear();
+		int w = (cols - 1) * step_x + frame_width;
+		int h = (rows - 1) * step_y + frame_height;
+		for (;;) {	// halve until the whole level fits in one tile
+			level L;
+			L.width = w; L.height = h;
+			L.tiles_x = (w + T - 1) / T; L.tiles_y = (h + T - 1) / T;
+			L.remaining.assign((size_t)L.tiles_x * L.tiles_y, 0);
+			L.offsets.assign((size_t)L.tiles_x * L.tiles_y, 0);
+			levels.push_back(L);
+			if (w <= T && h <= T) break;
+			w = (w + 1) / 2; h = (h + 1) / 2;
+		}
+
+		level &base = levels[0];	// count the frames covering every full resolution tile
+		for (int j = 0; j < rows; j++)
+			for (int i = 0; i < cols; i++) {
+				int x0 = i * step_x, y0 = j * step_y;
+				for (int ty = y0 / T; ty <= (y0 + frame_height - 1) / T; ty++)
+					for (int tx = x0 / T; tx <= (x0 + frame_width - 1) / T; tx++)
+						base.remaining[ty * base.tiles_x + tx]++;
+			}
+		for (size_t l = 1; l < levels.size(); l++) {	// and the existing children of every reduced tile
+			level &child = levels[l - 1];
+			level &L = levels[l];
+			for (int ty = 0; ty < L.tiles_y; ty++)
+				for (int tx = 0; tx < L.tiles_x; tx++)
+					L.remaining[ty * L.tiles_x + tx] = (std::min(child.tiles_x, 2 * tx + 2) - 2 * tx) * (std::min(child.tiles_y, 2 * ty + 2) - 2 * ty);
+		}
+
+		return 0;
+	}
+
+	std::vector<unsigned char> &mosaic::buffer(int l, int t) {
+		std::vector<unsigned char> &b = levels[l].pending[t];
+		if (b.empty()) b.assign(tile_bytes, 0);
+		return b;
+	}
+
+	void mosaic::finish(int l, int t) {
+		level &L = levels[l];
+		std::vector<unsigned char> data;
+		std::unordered_map<int, std::vector<unsigned char> >::iterator it = L.pending.find(t);
+		if (it != L.pending.end()) {
+			data.swap(it->second);
+			L.pending.erase(it);
+		}
+		else
+			data.assign(tile_bytes, 0);	// nothing covers this tile
+
+		file.seekp((std::streamoff)end);
+		file.write((const char*)&data[0], tile_bytes);
+		L.offsets[t] = end;
+		end += tile_bytes;
+
+		if (l + 1 == (int)levels.size()) return;
+		int tx = t % L.tiles_x, ty = t / L.tiles_x;
+		level &P = levels[l + 1];
+		int p = (ty / 2) * P.tiles_x + tx / 2;
+		std::vector<unsigned char> &dst = buffer(l + 1, p);
+		int qx = (tx & 1) * (T / 2), qy = (ty & 1) * (T / 2);
+		for (int y = 0; y < T / 2; y++) {	// 2x2 box average into the matching quadrant of the parent
+			const unsigned char *s0 = &data[(size_t)(2 * y) * T * 3];
+			const unsigned char *s1 = s0 + T * 3;
+			unsigned char *d = &dst[((size_t)(qy + y) * T + qx) * 3];
+			for (int x = 0; x < T / 2; x++)
+				for (int c = 0; c < 3; c++)
+					d[x * 3 + c] = (unsigned char)((s0[6 * x + c] + s0[6 * x + 3 + c] + s1[6 * x + c] + s1[6 * x + 3 + c] + 2) >> 2);
+		}
+		if (--P.remaining[p] == 0)
+			finish(l + 1, p);
+	}
+
+	template<typename T_in, typename F>
+	static void copy_rows(const T_in *in, int fw, int x0, int y0, int xa, int xb, int ya, int yb, int tx, int ty, unsigned char *dst, F convert) {
+		for (int y = ya; y < yb; y++) {
+			const T_in *s = in + ((size_t)(y - y0) * fw + (xa - x0)) * 3;
+			unsigned char *d = dst + ((size_t)(y - ty * T) * T + (xa - tx * T)) * 3;
+			for (int i = 0; i < (xb - xa) * 3; i++)
+				d[i] = convert(s[i]);
+		}
+	}
+
+	template<typename T_in, typename F>
+	void mosaic::put(int row, int col, const T_in *rgb, F convert) {
+		if (!file.is_open() || row < 0 || row >= rows || col < 0 || col >= cols) return;
+		std::lock_guard<std::mutex> guard(lock);
+		level &L = levels[0];
+		int x0 = col * step_x, y0 = row * step_y;
+		for (int ty = y0 / T; ty <= (y0 + frame_height - 1) / T; ty++)
+			for (int tx = x0 / T; tx <= (x0 + frame_width - 1) / T; tx++) {
+				int t = ty * L.tiles_x + tx;
+				if (L.offsets[t]) continue;	// already on disk, a frame placed twice only fills its pending tiles
+				int xa = std::max(x0, tx * T), xb = std::min(std::min(x0 + frame_width, (tx + 1) * T), L.width);
+				int ya = std::max(y0, ty * T), yb = std::min(std::min(y0 + frame_height, (ty + 1) * T), L.height);
+				copy_rows(rgb, frame_width, x0, y0, xa, xb, ya, yb, tx, ty, &buffer(0, t)[0], convert);	// later frames overwrite the overlap
+				if (--L.remaining[t] == 0)
+					finish(0, t);
+			}
+	}
+
+	void mosaic::place(int row, int col, const unsigned char *rgb) {
+		put(row, col, rgb, [](unsigned char v) { return v; });
+	}
+
+	void mosaic::place(int row, int col, const unsigned short *rgb, int bits) {
+		int shift = bits > 8 ? bits - 8 : 0;
+		put(row, col, rgb, [shift](unsigned short v) { return (unsigned char)(v >> shift); });
+	}
+
+	void mosaic::write_ifds() {
+		unsigned long long link = 8;	// where the offset of the next directory goes, the header first
+		for (size_t l = 0; l < levels.size(); l++) {
+			level &L = levels[l];
+			unsigned long long n = L.offsets.size();
+
+			std::vector<unsigned char> arrays;	// tile offsets and byte counts, out of line unless a single tile
+			std::vector<unsigned long long> counts(n, tile_bytes);
+			unsigned long long offsets_at = end, counts_at = end + n * 8;
+			if (n > 1) {
+				append(arrays, &L.offsets[0], n * 8);
+				append(arrays, &counts[0], n * 8);
+				file.seekp((std::streamoff)end);
+				file.write((const char*)&arrays[0], arrays.size());
+				end += arrays.size();
+			}
+
+			unsigned int res[2] = { (unsigned int)std::lround(1.0e7 / psize), (unsigned int)(1000u << l) };	// pixels per cm at this level
+			unsigned long long res_value; std::memcpy(&res_value, res, 8);
+			unsigned short bps[4] = { 8, 8, 8, 0 };
+			unsigned long long bps_value; std::memcpy(&bps_value, bps, 8);
+			ifd_entry entries[] = {
+				{ 254, TIFF_LONG, 1, l ? 1ull : 0ull },			// new subfile type, reduced resolution below level 0
+				{ 256, TIFF_LONG, 1, (unsigned long long)L.width },
+				{ 257, TIFF_LONG, 1, (unsigned long long)L.height },
+				{ 258, TIFF_SHORT, 3, bps_value },				// bits per sample
+				{ 259, TIFF_SHORT, 1, 1 },						// no compression
+				{ 262, TIFF_SHORT, 1, 2 },						// RGB
+				{ 277, TIFF_SHORT, 1, 3 },						// samples per pixel
+				{ 282, TIFF_RATIONAL, 1, res_value },			// x resolution
+				{ 283, TIFF_RATIONAL, 1, res_value },			// y resolution
+				{ 284, TIFF_SHORT, 1, 1 },						// interleaved
+				{ 296, TIFF_SHORT, 1, 3 },						// resolution in centimeters
+				{ 322, TIFF_SHORT, 1, (unsigned long long)T },	// tile width
+				{ 323, TIFF_SHORT, 1, (unsigned long long)T },	// tile length
+				{ 324, TIFF_LONG8, n, n > 1 ? offsets_at : L.offsets[0] },
+				{ 325, TIFF_LONG8, n, n > 1 ? counts_at : counts[0] },
+			};
+			unsigned long long count = sizeof(entries) / sizeof(entries[0]);
+
+			std::vector<unsigned char> ifd;
+			append(ifd, &count, 8);
+			for (size_t e = 0; e < count; e++) {
+				append(ifd, &entries[e].tag, 2);
+				append(ifd, &entries[e].type, 2);
+				append(ifd, &entries[e].count, 8);
+				append(ifd, &entries[e].value, 8);
+			}
+			unsigned long long next = 0;
+			append(ifd, &next, 8);
+
+			unsigned long long at = end;
+			file.seekp((std::streamoff)at);
+			file.write((const char*)&ifd[0], ifd.size());
+			end += ifd.size();
+			file.seekp((std::streamoff)link);	// chain the previous directory to this one
+			file.write((const char*)&at, 8);
+			link = at + ifd.size() - 8;
+		}
+	}
+
+	void mosaic::close() {
+		if (!file.is_open()) return;
+		std::lock_guard<std::mutex> guard(lock);
+		for (size_t l = 0; l < levels.size(); l++)	// frames that never arrived leave tiles pending, finishing a level completes the next one
+			for (size_t t = 0; t < levels[l].offsets.size(); t++)
+				if (!levels[l].offsets[t])
+					finish((int)l, (int)t);
+		write_ifds();
+		file.close();
+		levels.clear();
+	}
+}
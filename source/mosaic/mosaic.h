@@ -0,0 +1,60 @@
+// streaming tiled BigTIFF writer for the whole scan mosaic
+// frames are placed on the nominal scan grid as they arrive, an output tile is written as soon as every frame covering it has been placed
+// finished tiles are 2x2 averaged into the next pyramid level right away, so only the tiles still waiting for a frame stay in memory
+// the image file directories are written at close(), the slide opens in whole-slide viewers as an 8bit RGB tiled pyramid
+
+#pragma once
+
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+namespace stim {
+	class mosaic {
+	private:
+		struct level {
+			int width;											// level size in pixels
+			int height;
+			int tiles_x;										// tile grid size
+			int tiles_y;
+			std::vector<int> remaining;							// contributors each tile still waits for
+			std::vector<unsigned long long> offsets;			// file offset of every written tile, 0 while pending
+			std::unordered_map<int, std::vector<unsigned char> > pending;	// tiles with at least one contribution
+		};
+
+		std::ofstream file;			// BigTIFF output
+		std::mutex lock;			// writers place frames concurrently
+		std::vector<level> levels;	// full resolution first
+		unsigned long long end;		// current file size
+		int frame_width;			// frame size in pixels
+		int frame_height;
+		int step_x;					// nominal grid step in pixels
+		int step_y;
+		int cols;					// mosaic grid
+		int rows;
+		float psize;				// pixel size in um/pixel
+
+		std::vector<unsigned char> &buffer(int l, int t);	// pending tile, zero filled on first use
+		void finish(int l, int t);		// write a tile and fold it into the next level
+		template<typename T_in, typename F> void put(int row, int col, const T_in *rgb, F convert);	// copy a frame into its pending tiles
+		void write_ifds();				// one directory per pyramid level
+
+	public:
+		static const int tile_size = 512;	// output tile edge in pixels
+
+		mosaic();
+		~mosaic();
+
+		int create(std::string filename, int fw, int fh, int c, int r, int sx, int sy, float ps);	// frames of fw x fh on a c x r grid stepping sx, sy pixels
+		void place(int row, int col, const unsigned char *rgb);		// place an interleaved 24bit frame
+		void place(int row, int col, const unsigned short *rgb, int bits);	// place an interleaved 48bit frame of bits per sample, kept at 8bit
+		void close();	// write every remaining tile and the directories
+	};
+}
+
+#endif
@@ -0,0 +1,56 @@
+// blocking frame queue shared by the acquisition pipeline stages
+
+#pragma once
+
+#ifndef FQUEUE_H
+#define FQUEUE_H
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+namespace stim {
+	template<typename T>
+	class fqueue {
+	private:
+		std::queue<T> items;			// queued items in arrival order
+		std::mutex lock;				// queue guard
+		std::condition_variable ready;	// signaled on push and close
+		bool closed;					// no more items will be pushed
+
+	public:
+		fqueue() { closed = false; }
+
+		void push(T item) {	// append an item and wake up one consumer
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				items.push(item);
+			}
+			ready.notify_one();
+		}
+
+		bool pop(T &item) {	// block until an item is available, false once the queue is closed and drained
+			std::unique_lock<std::mutex> guard(lock);
+			ready.wait(guard, [this] { return !items.empty() || closed; });
+			if (items.empty()) return false;
+			item = items.front();
+			items.pop();
+			return true;
+		}
+
+		void close() {	// release every blocked consumer
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				closed = true;
+			}
+			ready.notify_all();
+		}
+
+		void reopen() {	// accept items again after close()
+			std::lock_guard<std::mutex> guard(lock);
+			closed = false;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "pipeline.h"
+#include "../color/pack12.h"
+
+namespace stim {
+	pipeline::pipeline() {
+		cam = 0;
+		store = 0;
+		slide = 0;
+		maps = 0;
+		inflight = 0;
+	}
+
+	pipeline::~pipeline() {
+		stop();
+	}
+
+	pixel_layout pipeline::layout(const thorcam &c) {
+		if (c.d_raw) return c.bits() <= 12 ? RAW12 : RAW16;
+		return c.d_compression ? RGB24 : RGB48;
+	}
+
+	int pipeline::start(thorcam &c, int depth, int writers, scanfile *s, mosaic *m, focusfile *fm) {
+		if (depth < 1 || writers < 1) { std::cout << "pipeline requires at least one frame and one writer" << std::endl; return 1; }
+		cam = &c;
+		store = s;
+		slide = cam->d_raw ? 0 : m;	// raw frames have no color to place
+		maps = fm;
+		free_frames.reopen(); transform_queue.reopen(); write_queue.reopen();
+
+		pool.resize(depth);
+		for (int i = 0; i < depth; i++) {	// allocate the frame pool once, buffers cycle through the stages afterwards
+			pool[i].raw = 0;
+			pool[i].output = (cam->d_raw || cam->d_compression) ? 0 : new unsigned short[width * height * 3];	// raw frames are written from the ring slot
+			pool[i].output_24 = (!cam->d_raw && cam->d_compression) ? new unsigned char[width * height * 3] : 0;
+			pool[i].packed = (cam->d_raw && cam->bits() <= 12) ? new unsigned char[color::packed12_size((size_t)width * height)] : 0;	// queued raw frames cost 1.5 bytes per pixel
+			pool[i].count = 0;
+			free_frames.push(&pool[i]);
+		}
+
+		workers.push_back(std::thread(&pipeline::transform_worker, this));	// processor handles are serialized, one transform worker is enough
+		for (int i = 0; i < writers; i++)
+			workers.push_back(std::thread(&pipeline::write_worker, this));	// encoding dominates, use several writers
+
+		return 0;
+	}
+
+	void pipeline::push(int count, std::string suffix, const tile &t) {
+		frame *f;
+		if (!free_frames.pop(f)) return;	// blocks when every buffer is in flight, bounding memory usage
+		{
+			std::lock_guard<std::mutex> guard(inflight_lock);
+			inflight++;
+		}
+		f->raw = cam->capture();	// sensor readout on the calling thread
+		f->count = count;
+		f->suffix = suffix;
+		f->key = t;
+		transform_queue.push(f);
+	}
+
+	void pipeline::transform_worker() {
+		frame *f;
+		while (transform_queue.pop(f)) {
+			if (maps) measure(f);
+			if (cam->d_raw) {	// development is deferred
+				if (f->packed) {	// pack and free the ring slot right away
+					color::pack12(f->raw->data, f->packed, (size_t)width * height);
+					cam->release(f->raw);
+					f->raw = 0;
+				}
+				write_queue.push(f);	// otherwise the writers store the slot itself
+				continue;
+			}
+			cam->transform(f->raw, f->output, f->output_24);
+			cam->release(f->raw);	// the ring slot is free as soon as the color processing finished
+			f->raw = 0;
+			write_queue.push(f);
+		}
+	}
+
+	void pipeline::write_worker() {
+		frame *f;
+		while (write_queue.pop(f)) {
+			if (store) {	// one chunk of the scan container per frame
+				const void *payload = f->packed ? (const void*)f->packed : f->raw ? (const void*)f->raw->data : f->output_24 ? (const void*)f->output_24 : (const void*)f->output;
+				store->write(f->key, f->count, payload);
+				if (f->raw) {
+					cam->release(f->raw);
+					f->raw = 0;
+				}
+			}
+			else if (f->packed)	// raw mode, 12bit packed
+				cam->save_packed(f->packed, f->count, f->suffix);
+			else if (f->raw) {	// raw mode, the slot is held until the frame is on disk
+				cam->save_raw(f->raw->data, f->count, f->suffix);
+				cam->release(f->raw);
+				f->raw = 0;
+			}
+			else
+				cam->save(f->output, f->output_24, f->count, f->suffix);
+			if (slide && f->key.z == 0) {	// one frame per tile goes to the mosaic, the ground truth in comprehensive scans
+				if (f->output_24)
+					slide->place(f->key.row, f->key.col, f->output_24);
+				else
+					slide->place(f->key.row, f->key.col, f->output, cam->bits());
+			}
+			recycle(f);
+		}
+	}
+
+	void pipeline::measure(const frame *f) {
+		const focus_header &h = maps->info();
+		fm::focus_map map(h.cols, h.rows);	// superpixel luma, the same whatever color processing follows
+		float global = fm::eval_raw(f->raw->data, width, height, cam->phase(), (fm::fmetric)h.metric, map);
+		maps->write(f->key, global, map.values);
+	}
+
+	void pipeline::recycle(frame *f) {
+		free_frames.push(f);
+		{
+			std::lock_guard<std::mutex> guard(inflight_lock);
+			inflight--;
+		}
+		drained.notify_all();
+	}
+
+	void pipeline::flush() {
+		std::unique_lock<std::mutex> guard(inflight_lock);
+		drained.wait(guard, [this] { return inflight == 0; });
+	}
+
+	void pipeline::stop() {
+		if (workers.empty()) return;
+		flush();
+		free_frames.close(); transform_queue.close(); write_queue.close();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+
+		for (size_t i = 0; i < pool.size(); i++) {
+			if (pool[i].output) delete[] pool[i].output;
+			if (pool[i].output_24) delete[] pool[i].output_24;
+			if (pool[i].packed) delete[] pool[i].packed;
+		}
+		pool.clear();
+		frame *f;
+		while (free_frames.pop(f));	// drop stale pool pointers, queue is closed so this does not block
+		cam = 0;
+		store = 0;
+		slide = 0;
+		maps = 0;
+	}
+}
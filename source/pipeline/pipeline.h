@@ -0,0 +1,68 @@
+// asynchronous acquisition pipeline: acquire -> color transform -> encode & write
+// a fixed pool of frame buffers cycles through the stages, so the stage can move on as soon as the sensor readout finishes
+// raw frames are never copied: the transform reads the camera ring slot directly and releases it when done
+// in raw mode 12bit frames are packed into the pool buffer, wider frames skip the transform and the writer stores the ring slot itself
+// block focus maps are measured on the raw ring slot by the transform stage, before the slot is packed or released
+
+#pragma once
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "fqueue.h"
+#include "../tsi/thorcam.h"
+#include "../container/scanfile.h"
+#include "../container/focusfile.h"
+#include "../metric/fmeasure.h"
+#include "../mosaic/mosaic.h"
+
+namespace stim {
+	struct frame {
+		const fslot *raw;			// raw frame, read in place from the camera ring
+		unsigned short *output;		// processed frame buffer in 48bit
+		unsigned char *output_24;	// processed frame buffer in 24bit
+		unsigned char *packed;		// raw frame packed to 12bit
+		int count;					// frame index used as file name
+		std::string suffix;			// output sub-directory
+		tile key;					// mosaic position, used by the scan container
+	};
+
+	class pipeline {
+	private:
+		thorcam *cam;						// camera feeding the pipeline
+		scanfile *store;					// scan container, 0 writes one image file per frame
+		mosaic *slide;						// whole-slide BigTIFF fed with the processed frames, may be 0
+		focusfile *maps;					// block focus map of every frame, may be 0
+		std::vector<frame> pool;			// preallocated frame buffers
+		fqueue<frame*> free_frames;			// frames ready to be filled by acquisition
+		fqueue<frame*> transform_queue;		// raw frames waiting for color processing
+		fqueue<frame*> write_queue;			// processed frames waiting for encoding and disk write
+		std::vector<std::thread> workers;	// transform and writer threads
+		std::mutex inflight_lock;			// guard for inflight
+		std::condition_variable drained;	// signaled when a frame returns to the pool
+		int inflight;						// frames acquired but not yet written
+
+		void transform_worker();	// color processing stage
+		void write_worker();		// encoding and disk write stage
+		void recycle(frame *f);		// return a frame to the pool
+		void measure(const frame *f);	// block focus map of a raw frame
+
+	public:
+		pipeline();		// default constructor
+		~pipeline();	// destructor
+
+		static pixel_layout layout(const thorcam &c);	// payload the writers produce for this camera setup
+
+		int start(thorcam &c, int depth = 4, int writers = 2, scanfile *s = 0, mosaic *m = 0, focusfile *fm = 0);	// allocate the frame pool and spawn the workers
+		void push(int count, std::string suffix = "", const tile &t = tile());		// acquire a frame on the calling thread and queue it for processing
+		void flush();	// block until every queued frame is on disk
+		void stop();	// flush, join the workers and release the frame pool
+	};
+}
+
+#endif
@@ -0,0 +1,63 @@
+// runtime cpu feature detection and per-function instruction set targets
+// kernels are compiled for AVX2/AVX-512 individually and selected once at run time, so the binary still runs on older cpus
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_AVX2			// msvc emits intrinsics without a global /arch switch
+#define SIMD_AVX512
+#else
+#include <cpuid.h>
+#define SIMD_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_AVX512 __attribute__((target("avx512f,avx512bw,avx2,fma")))
+#endif
+
+namespace simd {
+	inline void cpuid(int leaf, int sub, int r[4]) {
+#ifdef _MSC_VER
+		__cpuidex(r, leaf, sub);
+#else
+		unsigned int a, b, c, d;
+		__cpuid_count(leaf, sub, a, b, c, d);
+		r[0] = (int)a; r[1] = (int)b; r[2] = (int)c; r[3] = (int)d;
+#endif
+	}
+
+	inline unsigned long long xgetbv0() {	// register state enabled by the operating system
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return ((unsigned long long)hi << 32) | lo;
+#endif
+	}
+
+	inline bool detect_avx2() {
+		int r[4];
+		cpuid(0, 0, r);
+		if (r[0] < 7) return false;
+		cpuid(1, 0, r);
+		if (!(r[2] & (1 << 27)) || !(r[2] & (1 << 28))) return false;	// osxsave and avx
+		if (!(r[2] & (1 << 12))) return false;							// fma, SIMD_AVX2 kernels are compiled with it
+		if ((xgetbv0() & 0x6) != 0x6) return false;						// xmm and ymm state
+		cpuid(7, 0, r);
+		return (r[1] & (1 << 5)) != 0;									// avx2
+	}
+
+	inline bool detect_avx512() {
+		if (!detect_avx2()) return false;
+		if ((xgetbv0() & 0xE6) != 0xE6) return false;					// opmask and zmm state
+		int r[4];
+		cpuid(7, 0, r);
+		return (r[1] & (1 << 16)) && (r[1] & (1 << 30));				// avx512f and avx512bw
+	}
+
+	inline bool avx2() { static const bool flag = detect_avx2(); return flag; }
+	inline bool avx512() { static const bool flag = detect_avx512(); return flag; }
+}
+
+#endif
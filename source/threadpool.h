@@ -0,0 +1,109 @@
+// persistent worker pool for row-band parallel loops, threads are spawned once and reused by every call
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace stim {
+	class threadpool {
+	private:
+		std::vector<std::thread> workers;	// persistent worker threads
+		std::mutex busy;					// one parallel loop at a time
+		std::mutex lock;					// guard for the job state below
+		std::condition_variable wake;		// signaled when a new job is posted
+		std::condition_variable done;		// signaled when the last task of a job finishes
+		const std::function<void(int)> *job;// current task body
+		int tasks;							// number of tasks in the current job
+		int next;							// next task index to hand out
+		int finished;						// tasks completed in the current job
+		unsigned long long generation;		// job counter, lets sleeping workers detect a new job
+		bool quit;							// workers exit when set
+
+		static bool &inside() {	// true on a pool worker, nested loops run inline instead of deadlocking
+			static thread_local bool flag = false;
+			return flag;
+		}
+
+		bool step() {	// run one task of the current job, false when none is left
+			int t;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (!job || next >= tasks) return false;
+				t = next++;
+			}
+			(*job)(t);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (++finished == tasks) done.notify_all();
+			}
+			return true;
+		}
+
+		void loop() {
+			inside() = true;
+			unsigned long long seen = 0;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					wake.wait(guard, [&] { return quit || generation != seen; });
+					if (quit) return;
+					seen = generation;
+				}
+				while (step());
+			}
+		}
+
+	public:
+		threadpool(int n = 0) {	// n <= 0 uses every hardware thread
+			job = 0; tasks = 0; next = 0; finished = 0; generation = 0; quit = false;
+			if (n <= 0) n = (int)std::thread::hardware_concurrency();
+			for (int i = 1; i < n; i++)	// the calling thread works too
+				workers.push_back(std::thread(&threadpool::loop, this));
+		}
+
+		~threadpool() {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				quit = true;
+			}
+			wake.notify_all();
+			for (size_t i = 0; i < workers.size(); i++)
+				workers[i].join();
+		}
+
+		int size() const { return (int)workers.size() + 1; }	// threads taking part in a loop
+
+		void run(int n, const std::function<void(int)> &f) {	// call f(0) .. f(n - 1) in parallel and return when all are done
+			if (n <= 0) return;
+			if (n == 1 || workers.empty() || inside()) {
+				for (int i = 0; i < n; i++) f(i);
+				return;
+			}
+			std::lock_guard<std::mutex> serial(busy);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				job = &f; tasks = n; next = 0; finished = 0;
+				generation++;
+			}
+			wake.notify_all();
+			inside() = true;	// tasks run here nest inline too, the busy lock is held
+			while (step());
+			inside() = false;
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [&] { return finished == tasks; });
+			job = 0;
+		}
+	};
+
+	inline threadpool &shared_pool() {	// process-wide pool shared by color processing and focus measure
+		static threadpool pool;
+		return pool;
+	}
+}
+
+#endif
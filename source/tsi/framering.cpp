@@ -0,0 +1,125 @@
+#include "framering.h"
+#include <thread>
+
+namespace stim {
+	framering::framering() {
+		slots = 0;
+		capacity = 0;
+		pixels = 0;
+		frame_width = 0;
+		frame_height = 0;
+		head = 0;
+		read = 0;
+		tail = 0;
+		overruns = 0;
+		counting = true;
+	}
+
+	framering::~framering() {
+		release();
+	}
+
+	int framering::allocate(int n, int w, int h) {
+		release();
+		if (n < 1) return 1;
+		size_t size = (size_t)w * h;
+		slots = new fslot[n];
+		for (int i = 0; i < n; i++) {
+			slots[i].data = new unsigned short[size];
+			slots[i].seq = 0;
+			slots[i].frame_count = 0;
+			slots[i].stamp = 0.0;
+			slots[i].width = w;
+			slots[i].height = h;
+			slots[i].refs = 0;
+		}
+		capacity = n;
+		pixels = size;
+		frame_width = w; frame_height = h;
+		head = 0; read = 0; tail = 0; overruns = 0;
+
+		return 0;
+	}
+
+	void framering::release() {
+		if (!slots) return;
+		for (int i = 0; i < capacity; i++)
+			delete[] slots[i].data;
+		delete[] slots;
+		slots = 0;
+		capacity = 0;
+	}
+
+	void framering::shape(int w, int h) {
+		if ((size_t)w * h > pixels) return;	// slots never grow, the full sensor frame is the largest readout
+		frame_width.store(w, std::memory_order_release);
+		frame_height.store(h, std::memory_order_release);
+	}
+
+	bool framering::push(const unsigned short *buffer, int frame_count) {
+		unsigned long long h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) >= (unsigned long long)capacity) {
+			reclaim();	// slots may have been released without being recycled yet
+			if (h - tail.load(std::memory_order_acquire) >= (unsigned long long)capacity) {	// consumer is behind, drop instead of blocking the sdk thread
+				if (counting.load(std::memory_order_relaxed)) overruns.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+		fslot &s = slots[h % capacity];
+		s.width = frame_width.load(std::memory_order_acquire);
+		s.height = frame_height.load(std::memory_order_acquire);
+		memcpy(s.data, buffer, sizeof(unsigned short) * (size_t)s.width * s.height);	// the sdk buffer only holds the current readout
+		s.seq = h;
+		s.frame_count = frame_count;
+		s.stamp = seconds();
+		head.store(h + 1, std::memory_order_release);	// publish only after the pixels are complete, so frames are never torn
+
+		return true;
+	}
+
+	const fslot *framering::claim() {
+		unsigned long long r = read.load(std::memory_order_relaxed);
+		if (r == head.load(std::memory_order_acquire)) return 0;
+		fslot *s = &slots[r % capacity];
+		s->refs.store(1, std::memory_order_relaxed);
+		read.store(r + 1, std::memory_order_release);
+		return s;
+	}
+
+	const fslot *framering::wait() {
+		const fslot *s;
+		while (!(s = claim()))
+			std::this_thread::yield();
+		return s;
+	}
+
+	void framering::wait_space() {
+		for (;;) {
+			reclaim();
+			if (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) < (unsigned long long)capacity) return;
+			std::this_thread::yield();
+		}
+	}
+
+	void framering::clear() {
+		read.store(head.load(std::memory_order_acquire), std::memory_order_release);	// skipped slots were never referenced and are recycled right away
+		reclaim();
+	}
+
+	void framering::retain(const fslot *s) {
+		const_cast<fslot*>(s)->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void framering::release(const fslot *s) {
+		if (const_cast<fslot*>(s)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			reclaim();
+	}
+
+	void framering::reclaim() {
+		unsigned long long t = tail.load(std::memory_order_acquire);
+		while (t < read.load(std::memory_order_acquire) && slots[t % capacity].refs.load(std::memory_order_acquire) == 0) {
+			if (!tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel)) continue;	// another thread advanced the tail, t now holds its value
+			t++;
+		}
+	}
+}
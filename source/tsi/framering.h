@@ -0,0 +1,63 @@
+// lock-free single-producer/single-consumer ring of preallocated frame slots
+// the sdk callback thread is the only producer and never blocks, the acquisition thread is the only consumer
+// claimed slots are reference counted, so downstream stages read the pixels in place and release them from any thread
+
+#pragma once
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <atomic>
+#include <cstring>
+#include <chrono>
+
+namespace stim {
+	inline double seconds() {	// steady clock time in seconds, the clock frames are stamped with
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	struct fslot {
+		unsigned short *data;		// raw frame pixels
+		unsigned long long seq;		// ring sequence number, gaps reveal dropped frames
+		int frame_count;			// frame count reported by the sdk
+		double stamp;				// seconds() when the frame reached the ring
+		int width;					// readout size of this frame, smaller than the slot while a region of interest is set
+		int height;
+		std::atomic<int> refs;		// outstanding references, the slot is recycled once it drops to zero
+	};
+
+	class framering {
+	private:
+		fslot *slots;								// preallocated frame slots
+		int capacity;								// number of slots
+		size_t pixels;								// pixels per slot
+		std::atomic<int> frame_width;				// readout size of the frames the sdk delivers now, at most pixels in total
+		std::atomic<int> frame_height;
+		std::atomic<unsigned long long> head;		// next sequence number to write, owned by the producer
+		std::atomic<unsigned long long> read;		// next sequence number to claim, owned by the consumer
+		std::atomic<unsigned long long> tail;		// oldest sequence number not yet recycled
+		std::atomic<unsigned long long> overruns;	// frames dropped because every slot was full
+		std::atomic<bool> counting;					// overruns are counted, off while dropping is expected
+
+	public:
+		framering();	// default constructor
+		~framering();	// destructor
+
+		int allocate(int n, int w, int h);	// allocate n slots of w x h pixels
+		void shape(int w, int h);			// readout size of the next frames, only while the camera is disarmed
+		void release();						// free all slots
+
+		bool push(const unsigned short *buffer, int frame_count);	// producer: copy a frame into the next free slot, false on overrun
+		const fslot *claim();	// consumer: take a reference to the oldest unread frame, null when empty
+		const fslot *wait();	// consumer: spin until a frame can be claimed
+		void wait_space();		// consumer: spin until at least one slot is free
+		void clear();			// consumer: drop every unread frame
+		void retain(const fslot *s);	// any thread: add a reference to a claimed slot
+		void release(const fslot *s);	// any thread: drop a reference, the slot returns to the producer at zero
+		void reclaim();			// any thread: recycle the released slots in sequence order
+		unsigned long long overrun_count() const { return overruns.load(); }
+		void count(bool on) { counting.store(on, std::memory_order_relaxed); }	// count the overruns from now on, or not
+	};
+}
+
+#endif
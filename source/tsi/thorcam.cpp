@@ -5,23 +5,13 @@ static float default_color_correction[9] = { 1.3f , -0.3f , 0.0f , -0.45f , 1.55
 static float home_white_balance[9] = { 1.0f , 0.0f , 0.0f , 0.0f , 1.37f, 0.0f , 0.0f , 0.0f , 2.79f };
 static float default_white_balance[9] = { 2.63f , 0.0f , 0.0f , 0.0f , 1.0f, 0.0f , 0.0f , 0.0f , 3.41f };
 
-HANDLE frame_acquired_event = 0;					// multi thread handle
-volatile int is_first_frame_finished = 1;			// first frame flag, very sensitive to threading
-unsigned short *callback_image_buffer_copy = 0;		// callback function frame buffer
-unsigned short *poll_image_buffer_copy = 0;			// poll function frame buffer
 int width = 4096; int height = 2160;				// frame width and height
 
+// runs on the sdk thread: copy the frame into the ring, which never blocks and counts overruns when the consumer is behind
 void frame_available_callback(void* sender, unsigned short* image_buffer, int frame_count, unsigned char* metadata, int metadata_size_in_bytes, void* context) {
-	if (is_first_frame_finished)
-		return;
-
-	is_first_frame_finished = 1;
-
-	if (!frame_acquired_event)
-		SetEvent(frame_acquired_event);
-
-	if (callback_image_buffer_copy)
-		memcpy(callback_image_buffer_copy, image_buffer, (sizeof(unsigned short) * width * height));
+	stim::framering *ring = (stim::framering*)context;
+	if (ring)
+		ring->push(image_buffer, frame_count);
 }
 
 namespace stim {
@@ -29,15 +19,22 @@ namespace stim {
 		is_camera_dll_open = 0;
 		is_camera_sdk_open = 0;
 		camera_handle = 0;
-		is_color_processing_sdk_open = 0;
-		is_demosaic_sdk_open = 0;
 		is_mono_to_color_sdk_open = 0;
-		color_processor_handle = 0;
 		mono_to_color_processor_handle = 0;
 
 		output_buffer = 0;
 		output_buffer_24 = 0;
-		demosaic_buffer = 0;
+		ring_depth = 4;
+		demosaic_method = color::MHC;
+
+		armed = false;
+		frames_per_trigger = 1;
+		pending_frames = 0;
+		focusing = false;
+		readout_width = 0;
+		readout_height = 0;
+		focus_roi[0] = 0; focus_roi[1] = 0; focus_roi[2] = -1; focus_roi[3] = -1;
+		focus_bin = 1;
 
 		exposure = 20;
 		gain = 0;
@@ -46,21 +43,29 @@ namespace stim {
 		d_thread = true;		// default to cpu multi-threading
 		d_demosaic = false;		// default basic demosaic
 		d_compression = true;	// default to compression 8bit
+		d_raw = false;			// default to color processing during the scan
 	}
 
 	thorcam::thorcam(bool thread, bool demosaic, bool compression) {
 		is_camera_dll_open = 0;
 		is_camera_sdk_open = 0;
 		camera_handle = 0;
-		is_color_processing_sdk_open = 0;
-		is_demosaic_sdk_open = 0;
 		is_mono_to_color_sdk_open = 0;
-		color_processor_handle = 0;
 		mono_to_color_processor_handle = 0;
 
 		output_buffer = 0;
 		output_buffer_24 = 0;
-		demosaic_buffer = 0;
+		ring_depth = 4;
+		demosaic_method = color::MHC;
+
+		armed = false;
+		frames_per_trigger = 1;
+		pending_frames = 0;
+		focusing = false;
+		readout_width = 0;
+		readout_height = 0;
+		focus_roi[0] = 0; focus_roi[1] = 0; focus_roi[2] = -1; focus_roi[3] = -1;
+		focus_bin = 1;
 
 		exposure = 20;
 		gain = 0;
@@ -69,6 +74,7 @@ namespace stim {
 		d_thread = thread;
 		d_demosaic = demosaic;
 		d_compression = compression;
+		d_raw = false;
 	}
 
 	thorcam::~thorcam() {
@@ -116,10 +122,9 @@ namespace stim {
 		if (tl_camera_get_image_width(camera_handle, &width)) { std::cout << "failed to get image width" << std::endl; return 1; }		// get the camera sensor block width
 		if (tl_camera_get_image_height(camera_handle, &height)) { std::cout << "failed to get image height" << std::endl; return 1; }	// get the camera sensor block height
 
-		callback_image_buffer_copy = new unsigned short[width * height];// allocate memory for callback image buffer copy
-		poll_image_buffer_copy = new unsigned short[width * height];	// allocate memory for poll image buffer copy
+		readout_width = width; readout_height = height;
+		if (ring.allocate(ring_depth, width, height)) { std::cout << "failed to allocate frame ring" << std::endl; return 1; }	// allocate slots for the frame ring, shared by the callback and poll paths
 		output_buffer = new unsigned short[width * height * 3];			// allocate memory for output color image
-		demosaic_buffer = new unsigned short[width * height * 3];		// allocate memory for temporary buffer to store demosaic result
 		output_buffer_24 = new unsigned char[width * height * 3];		// allocate memory for output_24 color image
 
 		return 0;
@@ -128,21 +133,9 @@ namespace stim {
 	int thorcam::configure() {
 
 		if (d_demosaic) {	// using bayer filter pattern to demosaic a raw monochrome image
-			if (tl_color_processing_initialize()) { std::cout << "failed to initialize color processing dll and sdk" << std::endl; return 1; }	// initialize color processing dll and sdk
-			is_color_processing_sdk_open = 1;
-			if (tl_demosaic_initialize()) { std::cout << "failed to initialize demosaic dll and sdk" << std::endl; return 1; }					// initialize demosaic dll and sdk
-			is_demosaic_sdk_open = 1;
-
-			color_processor_handle = tl_color_create_color_processor(bit_depth, bit_depth);	// construct a color processor
-			if (!color_processor_handle) { std::cout << "failed to construct a color processor" << std::endl; return 1; }
+			// fused in-tree processing: demosaic, white balance, color correction and sRGB companding in one pass per row
 			// append 3x3 matrix for correction multiplication, the order matters
-			tl_color_append_matrix(color_processor_handle, default_white_balance);
-			tl_color_append_matrix(color_processor_handle, default_color_correction);
-			// use RGB LUTs to configure an sRGB nonlinear function -- need to create own LUT
-			sRGB_companding_LUT(bit_depth, tl_color_get_red_output_LUT(color_processor_handle));	// follow RGB order as previous described
-			sRGB_companding_LUT(bit_depth, tl_color_get_green_output_LUT(color_processor_handle));
-			sRGB_companding_LUT(bit_depth, tl_color_get_blue_output_LUT(color_processor_handle));
-			tl_color_enable_output_LUTs(color_processor_handle, 1, 1, 1);	// applied preset LUT to data
+			developer.configure(bit_depth, (color::cfa)color_filter_array_phase, default_white_balance, default_color_correction, demosaic_method);
 		}
 		else {			// otherwise create RGB image directly from monochrome image using built-in api
 			if (tl_mono_to_color_processing_initialize()) { std::cout << "failed to initialize mono to color processing" << std::endl; return 1; }	// initialize mono to color dll and sdk
@@ -162,18 +155,78 @@ namespace stim {
 			tl_mono_to_color_set_blue_gain(mono_to_color_processor_handle, default_white_balance_matrix[8]);
 		}
 
-		if (tl_camera_set_frames_per_trigger_zero_for_unlimited(camera_handle, 0)) { std::cout << "failed to set trigger frame count" << std::endl; return 1; }	// continuous buffering when set to 0
+		if (tl_camera_set_frames_per_trigger_zero_for_unlimited(camera_handle, 1)) { std::cout << "failed to set trigger frame count" << std::endl; return 1; }	// one frame per trigger unless streaming
 		if (d_thread) {
-			if (tl_camera_set_frame_available_callback(camera_handle, frame_available_callback, 0)) { std::cout << "failed to set the frame available callback" << std::endl; return 1; }	// register a callback function to receive a notification when an image is available
+			if (tl_camera_set_frame_available_callback(camera_handle, frame_available_callback, &ring)) { std::cout << "failed to set the frame available callback" << std::endl; return 1; }	// register a callback function to receive a notification when an image is available
 		}
 		else {
 			if (tl_camera_set_image_poll_timeout(camera_handle, 1000)) { std::cout << "failed to set the  frame available polling" << std::endl; return 1; }	// 1000 = 1s wait for a frame to arrive during a poll
 		}
+		if (d_raw) {	// raw frames carry no color, record how the native path would develop them
+			_mkdir(output_dir.c_str());
+			if (develop_params().save(output_dir + "/develop.txt")) return 1;
+		}
+
+		return 0;
+	}
 
+	int thorcam::stream(int fpt) {
+		if (armed) disarm();
+		ring.clear();	// a new stream never hands out frames taken before it
+		if (tl_camera_set_frames_per_trigger_zero_for_unlimited(camera_handle, fpt)) { std::cout << "failed to set trigger frame count" << std::endl; return 1; }	// continuous buffering when set to 0
+		if (tl_camera_arm(camera_handle, 2)) { std::cout << "failed to arm camera" << std::endl; return 1; }	// arm once, triggers only release exposures from now on
+		armed = true;
+		frames_per_trigger = fpt;
+		pending_frames = 0;
+		ring.count(fpt != 0);	// a free-running stream overruns the ring between captures on purpose
+		if (frames_per_trigger == 0)
+			tl_camera_issue_software_trigger(camera_handle);	// a single trigger starts continuous delivery
+
+		return 0;
+	}
+
+	void thorcam::disarm() {
+		if (!armed) return;
+		if (tl_camera_disarm(camera_handle)) { std::cout << "failed to disarm camera" << std::endl; }
+		if (tl_camera_set_frames_per_trigger_zero_for_unlimited(camera_handle, 1)) { std::cout << "failed to set trigger frame count" << std::endl; }	// back to one frame per trigger
+		ring.clear();	// frames left over from the stream, e.g. an autofocus sweep, are never handed out as tiles
+		ring.count(true);
+		armed = false;
+		pending_frames = 0;
+	}
+
+	int thorcam::focus(bool on) {
+		bool roi = focus_roi[0] > 0 && focus_roi[1] > 0;
+		if (on == focusing || (on && !roi && focus_bin <= 1)) return 0;	// nothing to switch, autofocus reads full frames
+		bool resume = armed;
+		int fpt = frames_per_trigger;
+		disarm();	// the sdk only changes the readout while disarmed
+
+		int ulx = 0, uly = 0, lrx = width - 1, lry = height - 1, bin = 1;	// full frame
+		if (on) {
+			if (roi) {	// even size and origin keep the Bayer phase of the full frame
+				int w = (std::min)(focus_roi[0], width) & ~1, h = (std::min)(focus_roi[1], height) & ~1;	// parenthesized against the windows.h min macro
+				ulx = (focus_roi[2] < 0 ? (width - w) / 2 : (std::min)(focus_roi[2], width - w)) & ~1;
+				uly = (focus_roi[3] < 0 ? (height - h) / 2 : (std::min)(focus_roi[3], height - h)) & ~1;
+				lrx = ulx + w - 1; lry = uly + h - 1;
+			}
+			bin = focus_bin;
+		}
+		if (tl_camera_set_binx(camera_handle, 1) || tl_camera_set_biny(camera_handle, 1)) { std::cout << "failed to reset binning" << std::endl; return 1; }	// the region is given in unbinned sensor pixels
+		if (tl_camera_set_roi(camera_handle, ulx, uly, lrx, lry)) { std::cout << "failed to set region of interest" << std::endl; return 1; }
+		if (bin > 1 && (tl_camera_set_binx(camera_handle, bin) || tl_camera_set_biny(camera_handle, bin))) { std::cout << "failed to set binning" << std::endl; return 1; }
+		if (tl_camera_get_image_width(camera_handle, &readout_width)) { std::cout << "failed to get image width" << std::endl; return 1; }	// the sdk rounds the region to its own step
+		if (tl_camera_get_image_height(camera_handle, &readout_height)) { std::cout << "failed to get image height" << std::endl; return 1; }
+		ring.shape(readout_width, readout_height);
+		ring.clear();	// frames of the previous readout are never measured
+		focusing = on;
+
+		if (resume) return stream(fpt);
 		return 0;
 	}
 
 	void thorcam::disconnect() {
+		disarm();
 		if (camera_handle) {
 			if (tl_camera_close_camera(camera_handle)) { std::cout << "failed to close camera" << std::endl; }
 			camera_handle = 0;
@@ -186,12 +239,7 @@ namespace stim {
 			if (tl_camera_sdk_dll_terminate()) { std::cout << "failed to close dll" << std::endl; }
 			is_camera_dll_open = 0;
 		}
-		if (d_demosaic) {
-			if (color_processor_handle) { if (tl_color_destroy_color_processor(color_processor_handle)) { std::cout << "failed to destroy color processor" << std::endl; } }
-			if (is_color_processing_sdk_open) { if (tl_color_processing_terminate()) { std::cout << "failed to close color processing" << std::endl; } }
-			if (is_demosaic_sdk_open) { if (tl_demosaic_terminate()) { std::cout << "failed to close demosaic sdk" << std::endl; } }
-		}
-		else {
+		if (!d_demosaic) {
 			if (mono_to_color_processor_handle) {
 				if (tl_mono_to_color_destroy_mono_to_color_processor(mono_to_color_processor_handle)) { std::cout << "failed to destroy mono to color processor" << std::endl; }
 				mono_to_color_processor_handle = 0;
@@ -201,43 +249,39 @@ namespace stim {
 				is_mono_to_color_sdk_open = 0;
 			}
 		}
-		if (d_thread) {
-			if (frame_acquired_event) { if (!CloseHandle(frame_acquired_event)) { std::cout << "failed to close concurrent data structure" << std::endl; } }
-		}
-		if (callback_image_buffer_copy) {
-			delete[] callback_image_buffer_copy;
-			callback_image_buffer_copy = 0;
-		}
-		if (poll_image_buffer_copy) {
-			delete[] poll_image_buffer_copy;
-			poll_image_buffer_copy = 0;
-		}
+		ring.release();
 		if (output_buffer) {
 			delete[] output_buffer;
 			output_buffer = 0;
 		}
-		if (demosaic_buffer) {
-			delete[] demosaic_buffer;
-			demosaic_buffer = 0;
-		}
 		if (output_buffer_24) {
 			delete[] output_buffer_24;
 			output_buffer_24 = 0;
 		}
 	}
 
-	void thorcam::fire() {	
-		tl_camera_arm(camera_handle, 1);	// arm camera and set the number of frames to allocate in the internal image buffer to 2
-		
-		if (d_thread)
-			if (is_first_frame_finished)
-				is_first_frame_finished = 0;	// now start frame buffer
+	const fslot *thorcam::capture() {
+		int skip = (armed && frames_per_trigger == 0) ? 1 : 0;	// in continuous streaming the frame in flight may have been exposed during stage motion
+		if (!armed || frames_per_trigger == 0)
+			ring.clear();	// drop stale frames, only the exposures of a streaming burst are kept
+		ring.wait_space();	// downstream stages may still hold every slot, a frame delivered now would be dropped
+
+		if (!armed)
+			tl_camera_arm(camera_handle, 1);	// arm camera and set the number of frames to allocate in the internal image buffer to 2
+
+		if (!armed)
+			tl_camera_issue_software_trigger(camera_handle);	// sending a trigger command to the camera via USB 3.0
+		else if (frames_per_trigger != 0 && pending_frames == 0) {
+			tl_camera_issue_software_trigger(camera_handle);	// release the next burst of exposures
+			pending_frames = frames_per_trigger;
+		}
 
-		tl_camera_issue_software_trigger(camera_handle);	// sending a trigger command to the camera via USB 3.0
+		const fslot *s;
 		if (d_thread) {	// multi thread
-			for (;;) {	// wait for getting one image from buffer
-				WaitForSingleObject(frame_acquired_event, INFINITE);
-				if (is_first_frame_finished) break;
+			s = ring.wait();	// wait for getting one image from the ring
+			if (skip) {
+				ring.release(s);
+				s = ring.wait();
 			}
 		}
 		else {			// single thread
@@ -246,70 +290,83 @@ namespace stim {
 			unsigned char *metadata = 0;
 			int metadata_size_in_bytes = 0;
 
-			while (!image_buffer) {	// poll for one image
-				tl_camera_get_pending_frame_or_null(camera_handle, &image_buffer, &frame_count, &metadata, &metadata_size_in_bytes);
+			for (int i = 0; i <= skip; i++) {	// drop the frame in flight in continuous streaming, same as the callback path
+				image_buffer = 0;
+				while (!image_buffer) {	// poll for one image
+					tl_camera_get_pending_frame_or_null(camera_handle, &image_buffer, &frame_count, &metadata, &metadata_size_in_bytes);
+				}
 			}
-			memcpy(poll_image_buffer_copy, image_buffer, (sizeof(unsigned short) * width * height));
+			ring.push(image_buffer, frame_count);	// the sdk reuses its buffer on the next poll, this is the only copy
+			s = ring.claim();
 		}
-		//std::cout << "image #" << countI << " received..." << std::endl;	// now callback_image_buffer_copy has the unprocessed image
+		//std::cout << "image #" << countI << " received..." << std::endl;	// now the claimed slot has the unprocessed image
+		if (armed) {
+			if (frames_per_trigger != 0) pending_frames--;	// one exposure of the current burst consumed
+		}
+		else if (tl_camera_disarm(camera_handle)) { std::cout << "failed to disarm camera" << std::endl; }	// disarm camera
+
+		return s;
+	}
+
+	const fslot *thorcam::next(double deadline) {
+		const fslot *s = 0;
+		if (d_thread) {	// stamped by the callback as soon as the sdk delivers it
+			while (!(s = ring.claim())) {
+				if (seconds() > deadline) return 0;
+				std::this_thread::yield();
+			}
+			return s;
+		}
+		ring.wait_space();	// downstream stages may still hold every slot, the push below would fail
+		unsigned short *image_buffer = 0;
+		int frame_count = 0;
+		unsigned char *metadata = 0;
+		int metadata_size_in_bytes = 0;
+		while (!image_buffer) {	// poll for one image, stamped when the poll returns it
+			if (seconds() > deadline) return 0;
+			tl_camera_get_pending_frame_or_null(camera_handle, &image_buffer, &frame_count, &metadata, &metadata_size_in_bytes);
+		}
+		ring.push(image_buffer, frame_count);
+		return ring.claim();
+	}
+
+	int thorcam::delay(double &s) {
+		long long exposure_us = 0;
+		int readout_ns = 0;
+		if (tl_camera_get_exposure_time(camera_handle, &exposure_us)) { std::cout << "failed to get exposure time" << std::endl; return 1; }
+		if (tl_camera_get_sensor_readout_time(camera_handle, &readout_ns)) { std::cout << "failed to get sensor readout time" << std::endl; return 1; }
+		s = exposure_us * 0.5e-6 + readout_ns * 1.0e-9;	// half the exposure, then the readout, transfer time is not included
+		return 0;
+	}
+
+	void thorcam::release(const fslot *s) {
+		ring.release(s);
+	}
+
+	void thorcam::transform(const fslot *s, unsigned short *out, unsigned char *out_24, const color::strip_fn &strip) {
+		std::lock_guard<std::mutex> lock(color_mutex);	// mono to color processor handle is shared by all callers
+		const unsigned short *raw = s->data;
+		unsigned short *in = s->data;	// sdk transforms take non-const input
+		int w = s->width, h = s->height;	// focus profile frames are smaller than the output buffers
 
 		if (d_demosaic) {
 			// demosaic monochrome image data and create RGB data, expanding a single channel monochrome pixel data into three color channels of pixel data
-			if (d_thread)
-				tl_demosaic_transform_16_to_48(width, height, 0, 0, color_filter_array_phase, TL_COLOR_FORMAT_RGB_PIXEL, TL_COLOR_FILTER_TYPE_BAYER, bit_depth, callback_image_buffer_copy, demosaic_buffer);
-			else
-				tl_demosaic_transform_16_to_48(width, height, 0, 0, color_filter_array_phase, TL_COLOR_FORMAT_RGB_PIXEL, TL_COLOR_FILTER_TYPE_BAYER, bit_depth, poll_image_buffer_copy, demosaic_buffer);
+			// the raw frame is read once and each output pixel written once, no intermediate 48bit frame
 			if (d_compression)
-				tl_color_transform_48_to_24(color_processor_handle
-					, demosaic_buffer                   // input buffer
-					, TL_COLOR_FORMAT_RGB_PIXEL         // input buffer format, could be BGR or RGB
-					, 0                                 // blue minimum clamp value
-					, ((1 << bit_depth) - 1)            // blue maximum clamp value 
-					, 0                                 // green minimum clamp value
-					, ((1 << bit_depth) - 1)            // green maximum clamp value
-					, 0                                 // red minimum clamp value
-					, ((1 << bit_depth) - 1)            // red maximum clamp value
-					, 8 - bit_depth                     // blue shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, 8 - bit_depth                     // green shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, 8 - bit_depth					    // red shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, output_buffer_24                  // output buffer
-					, TL_COLOR_FORMAT_RGB_PIXEL         // output buffer format
-					, width * height);					// number of pixels in the image
+				developer.transform_24(raw, out_24, w, h, 0, true, strip);
 			else
-				tl_color_transform_48_to_48(color_processor_handle
-					, demosaic_buffer                   // input buffer
-					, TL_COLOR_FORMAT_RGB_PIXEL         // input buffer format, could be BGR or RGB
-					, 0                                 // blue minimum clamp value
-					, ((1 << bit_depth) - 1)            // blue maximum clamp value 
-					, 0                                 // green minimum clamp value
-					, ((1 << bit_depth) - 1)            // green maximum clamp value
-					, 0                                 // red minimum clamp value
-					, ((1 << bit_depth) - 1)            // red maximum clamp value
-					, 0                                 // blue shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, 0                                 // green shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, 0                                 // red shift distance (negative: bit-shift data right, positive: bit-shift data left) 
-					, output_buffer                     // output buffer
-					, TL_COLOR_FORMAT_RGB_PIXEL         // output buffer format
-					, width * height);					// number of pixels in the image
+				developer.transform_48(raw, out, w, h, 0, true, strip);
 		}
 		else {
-			if (d_thread) {	// using callbacks
-				if (d_compression)
-					tl_mono_to_color_transform_to_24(mono_to_color_processor_handle, callback_image_buffer_copy, width, height, output_buffer_24);
-				else
-					tl_mono_to_color_transform_to_48(mono_to_color_processor_handle, callback_image_buffer_copy, width, height, output_buffer);
-			}
-			else {			// using polls
-				if (d_compression)
-					tl_mono_to_color_transform_to_24(mono_to_color_processor_handle, poll_image_buffer_copy, width, height, output_buffer_24);
-				else
-					tl_mono_to_color_transform_to_48(mono_to_color_processor_handle, poll_image_buffer_copy, width, height, output_buffer);
-			}
+			if (d_compression)
+				tl_mono_to_color_transform_to_24(mono_to_color_processor_handle, in, w, h, out_24);
+			else
+				tl_mono_to_color_transform_to_48(mono_to_color_processor_handle, in, w, h, out);
+			if (strip) strip(0, h);	// the sdk hands back the whole frame at once
 		}
-		if (tl_camera_disarm(camera_handle)) { std::cout << "failed to disarm camera" << std::endl; }	// disarm camera
 	}
 
-	void thorcam::save(int count, std::string suffix) {
+	void thorcam::save(const unsigned short *out, const unsigned char *out_24, int count, std::string suffix) {
 		std::string dir = output_dir + suffix;
 		_mkdir(dir.c_str());	// create a folder if not exist
 		std::stringstream ss;
@@ -318,12 +375,44 @@ namespace stim {
 		ss << dir << "/" << n.str() << "." << format;
 		std::string image_name = ss.str();
 		if (d_compression) {	// save in 24bpp
-			stim::image<unsigned char> I(&output_buffer_24[0], width, height, 3);
+			stim::image<unsigned char> I(const_cast<unsigned char*>(out_24), width, height, 3);
 			I.save(image_name);
 		}
 		else {				// save in 48bpp, could do 32bpp too with unsigned short * 4 if needed
-			stim::image<unsigned short> I(&output_buffer[0], width, height, 3);
+			stim::image<unsigned short> I(const_cast<unsigned short*>(out), width, height, 3);
 			I.save(image_name);
 		}
 	}
+
+	void thorcam::save_raw(const unsigned short *raw, int count, std::string suffix) {
+		std::string dir = output_dir + suffix;
+		_mkdir(dir.c_str());	// create a folder if not exist
+		std::stringstream ss;
+		ss << dir << "/" << std::setfill('0') << std::setw(3) << count << ".raw.tif";	// always tif, one 16bit channel survives losslessly
+		stim::image<unsigned short> I(const_cast<unsigned short*>(raw), width, height, 1);
+		I.save(ss.str());
+	}
+
+	void thorcam::save_packed(const unsigned char *packed, int count, std::string suffix) {
+		std::string dir = output_dir + suffix;
+		_mkdir(dir.c_str());	// create a folder if not exist
+		std::stringstream ss;
+		ss << dir << "/" << std::setfill('0') << std::setw(3) << count << ".raw12";	// headerless, frame size is in develop.txt
+		std::ofstream file(ss.str().c_str(), std::ios::binary);
+		file.write((const char*)packed, color::packed12_size((size_t)width * height));
+		if (!file) std::cout << "failed to write " << ss.str() << std::endl;
+	}
+
+	color::params thorcam::develop_params() const {
+		color::params p;
+		p.width = width;
+		p.height = height;
+		p.bit_depth = bit_depth;
+		p.phase = (color::cfa)color_filter_array_phase;
+		for (int i = 0; i < 9; i++) {	// the matrices configure() set up, the camera's own for the sdk processor
+			p.white_balance[i] = d_demosaic ? default_white_balance[i] : default_white_balance_matrix[i];
+			p.color_correction[i] = d_demosaic ? default_color_correction[i] : color_correction_matrix[i];
+		}
+		return p;
+	}
 }
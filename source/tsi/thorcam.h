@@ -9,6 +9,9 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <mutex>
+#include <thread>
+#include <algorithm>
 #include "windows.h"
 #include <stim/image/image.h>
 #include "tl_camera_sdk.h"
@@ -18,6 +21,10 @@
 #include "tl_color_processing_load.h"
 #include "tl_mono_to_color_processing_load.h"
 #include "tl_mono_to_color_processing.h"
+#include "framering.h"
+#include "../color/processor.h"
+#include "../color/params.h"
+#include "../color/pack12.h"
 
 extern int width; extern int height;	// camera frame width and height
 void frame_available_callback(void* sender, unsigned short* image_buffer, int frame_count, unsigned char* metadata, int metadata_size_in_bytes, void* context);
@@ -28,10 +35,7 @@ namespace stim {
 		int is_camera_dll_open;					// camera dll flag
 		int is_camera_sdk_open;					// camera sdk flag
 		void *camera_handle;					// camera handle
-		int is_color_processing_sdk_open;		// color processing sdk flag
-		int is_demosaic_sdk_open;				// demosaic sdk flag
 		int is_mono_to_color_sdk_open;			// mono to color processing sdk flag
-		void *color_processor_handle;			// color processor handle
 		void *mono_to_color_processor_handle;	// mono to color processor handle
 
 		enum TL_CAMERA_SENSOR_TYPE camera_sensor_type;				// camera sensor type
@@ -39,6 +43,8 @@ namespace stim {
 		float color_correction_matrix[9];							// color correction matrix append
 		float default_white_balance_matrix[9];						// default while balance matrix append
 		int bit_depth;												// image bit size
+		color::processor developer;									// fused demosaic and color processing
+		std::mutex color_mutex;										// serialize processor handles between the autofocus and pipeline workers
 
 	protected:
 		int exposure;			// camera exposure time in ms
@@ -46,15 +52,26 @@ namespace stim {
 		int black_level;		// camera black level no unit
 		std::string output_dir;	// camera output directory
 		std::string format;		// camera output format
+		bool armed;				// camera stays armed between frames in streaming mode
+		int frames_per_trigger;	// exposures released by one trigger while streaming, 0 for continuous
+		int pending_frames;		// exposures of the last trigger not yet consumed
+		framering ring;			// raw frames delivered by the sdk, read in place by the color processing
+		bool focusing;			// focus acquisition profile is active
+		int readout_width;		// size of the frames the camera delivers now
+		int readout_height;
 
 	public:
 		bool d_thread;		// device multi-threading flag
 		bool d_demosaic;	// device demosaicking flag
 		bool d_compression;	// device compression (8/16) flag
+		bool d_raw;			// store raw Bayer frames and develop them offline
 
 		unsigned short *output_buffer;		// output frame buffer in 48bit
 		unsigned char *output_buffer_24;	// output frame buffer in 24bit
-		unsigned short *demosaic_buffer;	// demosaic frame buffer
+		int ring_depth;						// number of slots in the callback frame ring
+		color::dmethod demosaic_method;		// interpolation used by the native demosaic
+		int focus_roi[4];					// focus profile readout (width, height, x, y) in sensor pixels, width or height 0 keeps the full frame, x or y < 0 centers it
+		int focus_bin;						// focus profile binning along both axes, 1 for none
 
 		thorcam();		// default constructor
 		thorcam(bool thread, bool demosaic, bool compression);		// copy constructor
@@ -63,9 +80,23 @@ namespace stim {
 		int connect(int expo, int gn, int bl, std::string odir, std::string fmt);	// initialize and connect to camera
 		int configure();	// configure camera
 		void disconnect();	// disconnect to camera
-		void fire();		// collect a frame
-		void save(int count, std::string suffix = "");	// save current frame
+		int stream(int fpt = 1);	// arm once and keep the camera armed until disarm(), triggers only release exposures
+		void disarm();		// leave streaming mode
+		int focus(bool on);	// switch between the focus profile and the full frame readout, re-arms a streaming camera
+		bool binned() const { return focusing && focus_bin > 1; }	// the readout mixes the Bayer channels, frames are single channel
+		unsigned long long dropped() const { return ring.overrun_count(); }	// frames dropped by the callback ring, continuous streaming excluded
+		int bits() const { return bit_depth; }	// significant bits per raw pixel
+		color::cfa phase() const { return (color::cfa)color_filter_array_phase; }	// Bayer phase of the raw frames
+		const fslot *capture();				// collect a raw frame into a ring slot owned by the caller until release()
+		const fslot *next(double deadline);	// next frame of a continuous stream in delivery order, owned by the caller until release(), null once seconds() passes deadline
+		int delay(double &s);				// seconds from the middle of an exposure to the frame reaching the ring
+		void release(const fslot *s);		// hand a captured slot back to the ring
+		void transform(const fslot *s, unsigned short *out, unsigned char *out_24, const color::strip_fn &strip = color::strip_fn());	// color-process a captured raw frame at its readout size, strip sees the finished rows
+		void save(const unsigned short *out, const unsigned char *out_24, int count, std::string suffix = "");	// save a processed frame
+		void save_raw(const unsigned short *raw, int count, std::string suffix = "");	// save a raw Bayer frame as captured
+		void save_packed(const unsigned char *packed, int count, std::string suffix = "");	// save a 12bit packed raw Bayer frame
+		color::params develop_params() const;	// everything needed to develop the raw frames offline
 	};
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file